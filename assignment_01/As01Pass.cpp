@@ -1,220 +1,1356 @@
 #include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/LazyValueInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/ConstantRange.h"
+#include "llvm/Support/KnownBits.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/IR/PatternMatch.h"
+#include "llvm/Transforms/Utils/Local.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
 #include "llvm/Support/raw_ostream.h"
+#include "RewriteRules.h"
 #include <iostream>
 #include <cmath>
 
 using namespace llvm;
 
 /*
-*   Get the operand number and the instruction and replace all uses with op
+*   Replace all uses of I with V and keep track of I, which is now dead: dead instructions
+*   are erased all together at the end of the pass (see runOnFunction)
 */
-void replaceUses(int opNumber, Instruction &I){
-    Value *op = I.getOperand(opNumber);
-    I.replaceAllUsesWith(op);
+void replaceAndTrack(Instruction &I, Value *V, SmallVectorImpl<WeakTrackingVH> &DeadInsts){
+    I.replaceAllUsesWith(V);
+    DeadInsts.push_back(&I);
 }
 
 /*
-*   Return true if the given operand types are "opposite"
-*   (specifically, we want add-sub and mul-sdiv pairs to be defined as such)
+*   Return the value of V if it is an integer constant or a splat vector of integer constants
+*   (e.g. <8 x i32> splat (i32 8) or zeroinitializer), nullptr otherwise
 */
-bool areOppositeOps(int op1, int op2){
-    return (op1 == Instruction::Add && op2 == Instruction::Sub)
-    || (op1 == Instruction::Sub && op2 == Instruction::Add);
+const APInt *getConstantValue(Value *V){
+    const APInt *C;
+    if (PatternMatch::match(V, PatternMatch::m_APInt(C)))
+        return C;
+    return nullptr;
+}
+
+/*
+*   Return the value of V if it is a floating point constant or a splat vector of
+*   floating point constants, nullptr otherwise
+*/
+const APFloat *getFPConstantValue(Value *V){
+    const APFloat *C;
+    if (PatternMatch::match(V, PatternMatch::m_APFloat(C)))
+        return C;
+    return nullptr;
+}
+
+/*
+*   Return the floating point constant of type Ty (splat if Ty is a vector) with value V
+*/
+Constant *getFPConstant(Type *Ty, const APFloat &V){
+    Constant *C = ConstantFP::get(Ty->getContext(), V);
+    if (auto *VecTy = dyn_cast<VectorType>(Ty))
+        return ConstantVector::getSplat(VecTy->getElementCount(), C);
+    return C;
+}
+
+/*
+*   Return true if V is a fixed vector of integer constants which are all powers of 2 (not
+*   necessarily equal), filling Logs with the base 2 logarithm of each element
+*/
+bool getPow2VectorElements(Value *V, SmallVectorImpl<Constant*> &Logs){
+    auto *VecTy = dyn_cast<FixedVectorType>(V->getType());
+    Constant *C = dyn_cast<Constant>(V);
+    if (!VecTy || !C)
+        return false;
+    for (unsigned i = 0; i < VecTy->getNumElements(); ++i) {
+        ConstantInt *Elt = dyn_cast_or_null<ConstantInt>(C->getAggregateElement(i));
+        if (!Elt || !Elt->getValue().isPowerOf2())
+            return false;
+        Logs.push_back(ConstantInt::get(Elt->getType(), Elt->getValue().logBase2()));
+    }
+    return true;
+}
+
+/*
+*   Return the value equivalent to I if it is an algebraic identity, nullptr otherwise
+*   (the identities are listed in RewriteRules.h)
+*/
+Value *simplifyAlgebraicIdentity(Instruction &I){
+    return rewrite::AlgebraicIdentityRules::simplify(I);
+}
+
+/*
+*   What is known about the values of the function: known bits (ValueTracking) and
+*   ranges of integers at a given instruction (LazyValueInfo)
+*/
+struct ValueFacts {
+    const DataLayout &DL;
+    AssumptionCache &AC;
+    const DominatorTree &DT;
+    LazyValueInfo &LVI;
+};
+
+/*
+*   Return the range of the integer (or integer vector element) V at the instruction CxtI
+*/
+ConstantRange getValueRange(Value *V, Instruction &CxtI, const ValueFacts &VF){
+    KnownBits Known = computeKnownBits(V, VF.DL, 0, &VF.AC, &CxtI, &VF.DT);
+    ConstantRange Range = ConstantRange::fromKnownBits(Known, /*IsSigned*/ false)
+        .intersectWith(ConstantRange::fromKnownBits(Known, /*IsSigned*/ true));
+    // LazyValueInfo only reasons about scalars
+    if (V->getType()->isIntegerTy()) {
+        Range = Range.intersectWith(VF.LVI.getConstantRange(V, &CxtI, /*UndefAllowed*/ false));
+    }
+    return Range;
+}
+
+/*
+*   Return true if the integer V is known to be non negative at the instruction CxtI
+*/
+bool isNonNegativeAt(Value *V, Instruction &CxtI, const ValueFacts &VF){
+    return getValueRange(V, CxtI, VF).isAllNonNegative();
+}
+
+/*
+*   Return the number of high bits of the integer V known to be zero at the instruction CxtI
+*/
+unsigned getLeadingZerosAt(Value *V, Instruction &CxtI, const ValueFacts &VF){
+    return getValueRange(V, CxtI, VF).getUnsignedMax().countLeadingZeros();
+}
+
+/*
+*   Return the value equivalent to I if its result is decided by the known bits or the
+*   ranges of its operands alone, nullptr otherwise:
+*   - icmp whose result is the same for all the values in the operand ranges
+*   - and/or where one operand is left unchanged, or the result is a constant
+*/
+Value *simplifyByRange(Instruction &I, const ValueFacts &VF){
+    if (ICmpInst *Cmp = dyn_cast<ICmpInst>(&I)) {
+        if (!Cmp->getOperand(0)->getType()->isIntOrIntVectorTy()) {
+            return nullptr;
+        }
+        ConstantRange LHS = getValueRange(Cmp->getOperand(0), I, VF);
+        ConstantRange RHS = getValueRange(Cmp->getOperand(1), I, VF);
+        if (LHS.icmp(Cmp->getPredicate(), RHS)) {
+            return ConstantInt::getTrue(I.getType());
+        }
+        if (LHS.icmp(Cmp->getInversePredicate(), RHS)) {
+            return ConstantInt::getFalse(I.getType());
+        }
+        return nullptr;
+    }
+    unsigned OP = I.getOpcode();
+    if (OP != Instruction::And && OP != Instruction::Or) {
+        return nullptr;
+    }
+    Value *X = I.getOperand(0), *Y = I.getOperand(1);
+    KnownBits KX = computeKnownBits(X, VF.DL, 0, &VF.AC, &I, &VF.DT);
+    KnownBits KY = computeKnownBits(Y, VF.DL, 0, &VF.AC, &I, &VF.DT);
+    if (OP == Instruction::And) {
+        // every bit is zero in one of the operands
+        if ((KX.Zero | KY.Zero).isAllOnes()) {
+            return Constant::getNullValue(I.getType());
+        }
+        // every bit set in X is set in Y: x & y = x
+        if ((KX.Zero | KY.One).isAllOnes()) {
+            return X;
+        }
+        if ((KY.Zero | KX.One).isAllOnes()) {
+            return Y;
+        }
+    } else {
+        // every bit is one in one of the operands
+        if ((KX.One | KY.One).isAllOnes()) {
+            return Constant::getAllOnesValue(I.getType());
+        }
+        // every bit set in Y is set in X: x | y = x
+        if ((KY.Zero | KX.One).isAllOnes()) {
+            return X;
+        }
+        if ((KX.Zero | KY.One).isAllOnes()) {
+            return Y;
+        }
+    }
+    return nullptr;
 }
 
 /*
 * 	Algebraic Identity Pass
 */
-bool AlgebraicIdentity(BasicBlock &B){
+bool AlgebraicIdentity(BasicBlock &B, const ValueFacts &VF, SmallVectorImpl<WeakTrackingVH> &DeadInsts){
     outs() << "Algebraic Identity\n";
+    bool Transformed = false;
     for (Instruction& I : B) {
-        // Check if the instruction is an add or sub
-        if ((I.getOpcode() == Instruction::Add) || (I.getOpcode() == Instruction::Sub)) {
-            // Get the operands of the instruction
-            ConstantInt *C1 = dyn_cast<ConstantInt>(I.getOperand(0)), *C2 = dyn_cast<ConstantInt>(I.getOperand(1));
-            // Check if the first operand is zero and the second one is not a constant
-            if ( C1 && !C2 && C1->getValue().isZero() ) {
-                replaceUses(1, I);
-            }
-            else if ( C2 && !C1 && C2->getValue().isZero() ) {
-                replaceUses(0, I);
-            }
+        Value *V = simplifyAlgebraicIdentity(I);
+        if (!V) {
+            V = simplifyByRange(I, VF);
         }
-        // Check if the instruction is a mul or a sub (signed)
-        if ((I.getOpcode() == Instruction::Mul) || (I.getOpcode() == Instruction::SDiv)) {
-            // Get the operands of the instruction
-            ConstantInt *C1 = dyn_cast<ConstantInt>(I.getOperand(0)), *C2 = dyn_cast<ConstantInt>(I.getOperand(1));
-            // Check if the first operand is zero and the second one is not a constant
-            if ( C1 && !C2 && C1->getValue().isOne() ) {
-                replaceUses(1, I);
-            }
-            else if ( C2 && !C1 && C2->getValue().isOne() ) {
-                replaceUses(0, I);
-            }
+        if (V) {
+            replaceAndTrack(I, V, DeadInsts);
+            Transformed = true;
         }
         outs() << I << "\n";
     }
-    return true;
+    return Transformed;
 }
 
 
 /*
 * Create the left shift for ("baisc") strength reduction
 */
-void LShiftReplace(int opNumb ,Instruction &I, ConstantInt *C){
+Value *LShiftReplace(int opNumb ,Instruction &I, const APInt *C){
     // Create a new shift instruction
-    BinaryOperator *Shift = BinaryOperator::Create(Instruction::Shl, I.getOperand(opNumb), ConstantInt::get(I.getOperand(opNumb)->getType(), C->getValue().logBase2()), "shift");
-    // Replace all uses of the mul instruction with the shift instruction
-    Shift->insertAfter(&I);
-    I.replaceAllUsesWith(Shift);
+    BinaryOperator *Shift = BinaryOperator::Create(Instruction::Shl, I.getOperand(opNumb), ConstantInt::get(I.getOperand(opNumb)->getType(), C->logBase2()), "shift");
+    // Insert the shift instruction before the mul, it will replace all its uses
+    Shift->insertBefore(&I);
+    return Shift;
 }
 /*
 * Create the right shift for ("basic") strength reduction
 */
-void RShiftReplace(int opNumb ,Instruction &I, ConstantInt *C){
+Value *RShiftReplace(int opNumb ,Instruction &I, const APInt *C){
+    // Create a new shift instruction
+    BinaryOperator *Shift = BinaryOperator::Create(Instruction::AShr, I.getOperand(opNumb), ConstantInt::get(I.getOperand(opNumb)->getType(), C->logBase2()), "shift");
+    // Insert the shift instruction before the mul, it will replace all its uses
+    Shift->insertBefore(&I);
+    return Shift;
+}
+/*
+* Create the logical right shift for ("basic") strength reduction of unsigned divisions
+*/
+Value *URShiftReplace(int opNumb ,Instruction &I, const APInt *C){
     // Create a new shift instruction
-    BinaryOperator *Shift = BinaryOperator::Create(Instruction::AShr, I.getOperand(opNumb), ConstantInt::get(I.getOperand(opNumb)->getType(), C->getValue().logBase2()), "shift");
-    // Replace all uses of the mul instruction with the shift instruction
-    Shift->insertAfter(&I);
-    I.replaceAllUsesWith(Shift);
+    BinaryOperator *Shift = BinaryOperator::Create(Instruction::LShr, I.getOperand(opNumb), ConstantInt::get(I.getOperand(opNumb)->getType(), C->logBase2()), "shift");
+    Shift->setIsExact(I.isExact());
+    // Insert the shift instruction before the udiv, it will replace all its uses
+    Shift->insertBefore(&I);
+    return Shift;
+}
+/*
+* Create the and with the low bit mask for ("basic") strength reduction of unsigned remainders
+*/
+Value *MaskReplace(int opNumb ,Instruction &I, const APInt *C){
+    // Create a new and instruction, keeping only the bits below the power of 2
+    BinaryOperator *And = BinaryOperator::Create(Instruction::And, I.getOperand(opNumb), ConstantInt::get(I.getOperand(opNumb)->getType(), *C-1), "mask");
+    // Insert the and instruction before the urem, it will replace all its uses
+    And->insertBefore(&I);
+    return And;
 }
 /*
 * Create the left shift and Sub instruction for ("advanced") strength reduction
 * This function is called when the constant is a power of 2 -1
 */
-void ShiftSubReplace( int opNumb, Instruction &I, ConstantInt *C){
+Value *ShiftSubReplace( int opNumb, Instruction &I, const APInt *C){
     // Create a new shift instruction
-    BinaryOperator *Shift = BinaryOperator::Create(Instruction::Shl, I.getOperand(opNumb), ConstantInt::get(I.getOperand(opNumb)->getType(), (C->getValue()+1).logBase2()), "shift");
+    BinaryOperator *Shift = BinaryOperator::Create(Instruction::Shl, I.getOperand(opNumb), ConstantInt::get(I.getOperand(opNumb)->getType(), (*C+1).logBase2()), "shift");
     // Create a new sub instruction
     BinaryOperator *Sub = BinaryOperator::Create(Instruction::Sub, Shift, I.getOperand(opNumb), "sub");
-    // Replace all uses of the mul instruction with the sub instruction
-    Shift->insertAfter(&I);
+    // Insert the new instructions before the mul, the sub will replace all its uses
+    Shift->insertBefore(&I);
     Sub->insertAfter(Shift);
-    I.replaceAllUsesWith(Sub);
+    return Sub;
 }
 /*
 * Create the right shift and Add instruction for ("advanced") strength reduction
 * This function is called when the constant is a power of 2 +1
 */
-void ShiftAddReplace(int opNumb, Instruction &I, ConstantInt *C){
+Value *ShiftAddReplace(int opNumb, Instruction &I, const APInt *C){
     // Create a new shift instruction
-    BinaryOperator *Shift = BinaryOperator::Create(Instruction::Shl, I.getOperand(opNumb), ConstantInt::get(I.getOperand(opNumb)->getType(), (C->getValue()-1).logBase2()), "shift");
+    BinaryOperator *Shift = BinaryOperator::Create(Instruction::Shl, I.getOperand(opNumb), ConstantInt::get(I.getOperand(opNumb)->getType(), (*C-1).logBase2()), "shift");
     // Create a new add instruction
     BinaryOperator *Add = BinaryOperator::Create(Instruction::Add, Shift, I.getOperand(opNumb), "add");
-    // Replace all uses of the mul instruction with the add instruction
-    Shift->insertAfter(&I);
+    // Insert the new instructions before the mul, the add will replace all its uses
+    Shift->insertBefore(&I);
     Add->insertAfter(Shift);
-    I.replaceAllUsesWith(Add);
+    return Add;
+}
+
+/*
+* One step of a shift/add/sub chain computing a multiplication by a constant.
+* Operands are indexes of the values computed by the previous steps (0 is the multiplicand,
+* step i defines value i+1, ZeroOperand is the constant 0); for shifts RHS is the shift amount
+*/
+struct MulStep {
+    unsigned Opcode;
+    unsigned LHS;
+    unsigned RHS;
+};
+
+typedef SmallVector<MulStep, 8> MulChain;
+
+const unsigned ZeroOperand = ~0u;
+// recursion depth of the factorization search
+const unsigned MulSearchDepth = 2;
+
+/*
+* Index of the value defined by the last step of the chain
+*/
+unsigned lastMulValue(const MulChain &Chain){
+    return Chain.size();
+}
+
+/*
+* Build the chain for the canonical signed digit (non adjacent form) encoding of C:
+* every non zero digit becomes a shifted copy of the multiplicand, and the terms are
+* summed as a balanced tree to keep the critical path short
+*/
+MulChain csdMulChain(const APInt &C){
+    unsigned BitWidth = C.getBitWidth();
+    MulChain Chain;
+    // (value index, negative sign) for every term still to be summed
+    SmallVector<std::pair<unsigned, bool>, 16> Terms;
+    APInt N = C.zext(BitWidth + 2);
+    for (unsigned Pos = 0; !N.isZero() && Pos < BitWidth; ++Pos, N.lshrInPlace(1)) {
+        if (!N[0])
+            continue;
+        // digit is +1 if N = 1 (mod 4), -1 if N = 3 (mod 4)
+        bool Negative = N[1];
+        if (Negative)
+            N += 1;
+        else
+            N -= 1;
+        unsigned Term = 0;
+        if (Pos > 0) {
+            Chain.push_back({Instruction::Shl, 0, Pos});
+            Term = lastMulValue(Chain);
+        }
+        Terms.push_back({Term, Negative});
+    }
+    // pairwise reduction of the terms
+    while (Terms.size() > 1) {
+        SmallVector<std::pair<unsigned, bool>, 16> Next;
+        for (unsigned i = 0; i + 1 < Terms.size(); i += 2) {
+            auto A = Terms[i], B = Terms[i + 1];
+            if (A.second == B.second) {
+                Chain.push_back({Instruction::Add, A.first, B.first});
+                Next.push_back({lastMulValue(Chain), A.second});
+            } else {
+                // the result keeps the sign of the positive term
+                if (A.second)
+                    std::swap(A, B);
+                Chain.push_back({Instruction::Sub, A.first, B.first});
+                Next.push_back({lastMulValue(Chain), false});
+            }
+        }
+        if (Terms.size() % 2)
+            Next.push_back(Terms.back());
+        Terms = Next;
+    }
+    if (!Terms.empty() && Terms[0].second)
+        Chain.push_back({Instruction::Sub, ZeroOperand, Terms[0].first});
+    return Chain;
+}
+
+/*
+* Latency of the critical path and total cost of the chain, according to the target cost model
+*/
+std::pair<InstructionCost, InstructionCost> mulChainCost(const MulChain &Chain, Type *Ty, const TargetTransformInfo &TTI){
+    SmallVector<InstructionCost, 16> Latency(Chain.size() + 1, 0);
+    InstructionCost Total = 0;
+    for (unsigned i = 0; i < Chain.size(); ++i) {
+        const MulStep &S = Chain[i];
+        InstructionCost Start = (S.LHS == ZeroOperand) ? InstructionCost(0) : Latency[S.LHS];
+        if (S.Opcode != Instruction::Shl && S.RHS != ZeroOperand)
+            Start = std::max(Start, Latency[S.RHS]);
+        Latency[i + 1] = Start + TTI.getArithmeticInstrCost(S.Opcode, Ty, TargetTransformInfo::TCK_Latency);
+        Total += TTI.getArithmeticInstrCost(S.Opcode, Ty, TargetTransformInfo::TCK_RecipThroughput);
+    }
+    return {Latency.back(), Total};
+}
+
+/*
+* Return true if chain A is cheaper than chain B (critical path first, then total cost)
+*/
+bool isCheaperMulChain(const MulChain &A, const MulChain &B, Type *Ty, const TargetTransformInfo &TTI){
+    return mulChainCost(A, Ty, TTI) < mulChainCost(B, Ty, TTI);
+}
+
+/*
+* Search the cheapest chain for C among its CSD encoding and the factorizations
+* C = C' * 2^k and C = C' * (2^a +- 1), where C' is decomposed recursively
+*/
+MulChain findMulChain(const APInt &C, unsigned Depth, Type *Ty, const TargetTransformInfo &TTI){
+    unsigned BitWidth = C.getBitWidth();
+    MulChain Best = csdMulChain(C);
+    if (Depth == 0)
+        return Best;
+
+    // C = C' * 2^k: multiply by the odd part, then shift
+    unsigned TZ = C.countTrailingZeros();
+    if (TZ > 0 && !C.lshr(TZ).isOne()) {
+        MulChain Chain = findMulChain(C.lshr(TZ), Depth - 1, Ty, TTI);
+        Chain.push_back({Instruction::Shl, lastMulValue(Chain), TZ});
+        if (isCheaperMulChain(Chain, Best, Ty, TTI))
+            Best = Chain;
+        return Best;
+    }
+
+    // C = C' * (2^a +- 1): y = x * C', then (y << a) +- y
+    for (unsigned A = 1; A < BitWidth; ++A) {
+        for (unsigned Opcode : {Instruction::Add, Instruction::Sub}) {
+            APInt Factor = APInt::getOneBitSet(BitWidth, A);
+            Factor = (Opcode == Instruction::Add) ? Factor + 1 : Factor - 1;
+            if (Factor.ule(1) || Factor.ugt(C) || !C.urem(Factor).isZero())
+                continue;
+            APInt Quot = C.udiv(Factor);
+            MulChain Chain;
+            if (!Quot.isOne())
+                Chain = findMulChain(Quot, Depth - 1, Ty, TTI);
+            unsigned Y = lastMulValue(Chain);
+            Chain.push_back({Instruction::Shl, Y, A});
+            Chain.push_back({Opcode, lastMulValue(Chain), Y});
+            if (isCheaperMulChain(Chain, Best, Ty, TTI))
+                Best = Chain;
+        }
+    }
+    return Best;
+}
+
+/*
+* Create the cheapest shift/add/sub chain found for a multiplication by a constant,
+* if the chain is faster than the target's multiply; return nullptr otherwise
+*/
+Value *MulChainReplace(int opNumb, Instruction &I, const APInt *C, const TargetTransformInfo &TTI){
+    Type *Ty = I.getType();
+    APInt Mult = *C;
+    // negative constants are decomposed by absolute value, the result is then negated
+    bool Negate = Mult.isNegative();
+    if (Negate)
+        Mult.negate();
+    MulChain Chain = findMulChain(Mult, MulSearchDepth, Ty, TTI);
+    if (Negate)
+        Chain.push_back({Instruction::Sub, ZeroOperand, lastMulValue(Chain)});
+
+    InstructionCost MulLatency = TTI.getArithmeticInstrCost(Instruction::Mul, Ty, TargetTransformInfo::TCK_Latency);
+    InstructionCost ChainLatency = mulChainCost(Chain, Ty, TTI).first;
+    if (!ChainLatency.isValid() || !MulLatency.isValid() || ChainLatency >= MulLatency)
+        return nullptr;
+
+    // materialize the chain right before the mul
+    IRBuilder<> Builder(&I);
+    SmallVector<Value*, 16> Values = {I.getOperand(opNumb)};
+    auto getOperand = [&](unsigned Idx) -> Value* {
+        return (Idx == ZeroOperand) ? Constant::getNullValue(Ty) : Values[Idx];
+    };
+    for (const MulStep &S : Chain) {
+        if (S.Opcode == Instruction::Shl)
+            Values.push_back(Builder.CreateShl(getOperand(S.LHS), S.RHS, "shift"));
+        else if (S.Opcode == Instruction::Add)
+            Values.push_back(Builder.CreateAdd(getOperand(S.LHS), getOperand(S.RHS), "add"));
+        else
+            Values.push_back(Builder.CreateSub(getOperand(S.LHS), getOperand(S.RHS), "sub"));
+    }
+    return Values.back();
+}
+
+/*
+* Magic number and shift amount used to replace a signed division by a constant
+*/
+struct SignedMagic {
+    APInt Magic;
+    unsigned Shift;
+};
+
+/*
+* Magic number and shift amount used to replace an unsigned division by a constant;
+* IsAdd is set when the magic number does not fit in the bit width and an extra add is needed
+*/
+struct UnsignedMagic {
+    APInt Magic;
+    unsigned Shift;
+    bool IsAdd;
+};
+
+/*
+* Compute the magic number for a signed division by D (|D| >= 2)
+* (Hacker's Delight, chapter 10-4)
+*/
+SignedMagic computeSignedMagic(const APInt &D){
+    unsigned BitWidth = D.getBitWidth();
+    APInt SignedMin = APInt::getSignedMinValue(BitWidth);
+    APInt AD = D.abs();
+    APInt T = SignedMin + D.lshr(BitWidth - 1);
+    APInt ANC = T - 1 - T.urem(AD);     // absolute value of nc
+    unsigned P = BitWidth - 1;
+    APInt Q1 = SignedMin.udiv(ANC);     // q1 = 2^p / |nc|
+    APInt R1 = SignedMin - Q1 * ANC;    // r1 = rem(2^p, |nc|)
+    APInt Q2 = SignedMin.udiv(AD);      // q2 = 2^p / |d|
+    APInt R2 = SignedMin - Q2 * AD;     // r2 = rem(2^p, |d|)
+    APInt Delta;
+    do {
+        P++;
+        Q1 <<= 1;
+        R1 <<= 1;
+        if (R1.uge(ANC)) {
+            Q1 += 1;
+            R1 -= ANC;
+        }
+        Q2 <<= 1;
+        R2 <<= 1;
+        if (R2.uge(AD)) {
+            Q2 += 1;
+            R2 -= AD;
+        }
+        Delta = AD - R2;
+    } while (Q1.ult(Delta) || (Q1 == Delta && R1.isZero()));
+
+    SignedMagic Res{Q2 + 1, P - BitWidth};
+    // a negative divisor needs a negative magic number
+    if (D.isNegative())
+        Res.Magic.negate();
+    return Res;
+}
+
+/*
+* Compute the magic number for an unsigned division by D (D >= 2, not a power of 2)
+* (Hacker's Delight, chapter 10-8). When the dividend is known to have LeadingZeros
+* zero high bits the magic number is smaller, and the add fixup is needed less often
+*/
+UnsignedMagic computeUnsignedMagic(const APInt &D, unsigned LeadingZeros = 0){
+    unsigned BitWidth = D.getBitWidth();
+    // the divisor must not exceed the largest dividend
+    LeadingZeros = std::min(LeadingZeros, D.countLeadingZeros());
+    // the largest dividend
+    APInt AllOnes = APInt::getAllOnes(BitWidth).lshr(LeadingZeros);
+    APInt SignedMin = APInt::getSignedMinValue(BitWidth);
+    APInt SignedMax = APInt::getSignedMaxValue(BitWidth);
+    bool IsAdd = false;
+    // the largest dividend such that nc + 1 is a multiple of d
+    APInt NC = AllOnes - (AllOnes + 1 - D).urem(D);
+    unsigned P = BitWidth - 1;
+    APInt Q1 = SignedMin.udiv(NC);      // q1 = 2^p / nc
+    APInt R1 = SignedMin - Q1 * NC;     // r1 = rem(2^p, nc)
+    APInt Q2 = SignedMax.udiv(D);       // q2 = (2^p - 1) / d
+    APInt R2 = SignedMax - Q2 * D;      // r2 = rem(2^p - 1, d)
+    APInt Delta;
+    do {
+        P++;
+        if (R1.uge(NC - R1)) {
+            Q1 = Q1 + Q1 + 1;
+            R1 = R1 + R1 - NC;
+        } else {
+            Q1 = Q1 + Q1;
+            R1 = R1 + R1;
+        }
+        if ((R2 + 1).uge(D - R2)) {
+            if (Q2.uge(SignedMax))
+                IsAdd = true;
+            Q2 = Q2 + Q2 + 1;
+            R2 = R2 + R2 + 1 - D;
+        } else {
+            if (Q2.uge(SignedMin))
+                IsAdd = true;
+            Q2 = Q2 + Q2;
+            R2 = R2 + R2 + 1;
+        }
+        Delta = D - 1 - R2;
+    } while (P < BitWidth * 2 && (Q1.ult(Delta) || (Q1 == Delta && R1.isZero())));
+
+    return {Q2 + 1, P - BitWidth, IsAdd};
+}
+
+/*
+* Create the instructions computing the upper half of the double width product N * Magic
+*/
+Value *buildMulHigh(IRBuilder<> &Builder, Value *N, const APInt &Magic, bool isSigned){
+    unsigned BitWidth = Magic.getBitWidth();
+    Type *WideTy = N->getType()->getExtendedType();
+    // extend both factors to the double width type, so that the multiplication cannot overflow
+    Value *WideN = isSigned ? Builder.CreateSExt(N, WideTy, "wide") : Builder.CreateZExt(N, WideTy, "wide");
+    APInt WideMagic = isSigned ? Magic.sext(2 * BitWidth) : Magic.zext(2 * BitWidth);
+    Value *Prod = Builder.CreateMul(WideN, ConstantInt::get(WideTy, WideMagic), "magic");
+    // the high half of the product is extracted with a shift and a truncation
+    Value *High = Builder.CreateLShr(Prod, BitWidth, "high");
+    return Builder.CreateTrunc(High, N->getType(), "mulhi");
+}
+
+/*
+* Create the instructions for a signed division of N by a (positive or negative) power of 2.
+* A bias of 2^k-1 is added to negative dividends so that the shift rounds towards zero
+*/
+Value *buildSDivPow2(IRBuilder<> &Builder, Value *N, const APInt &D){
+    unsigned BitWidth = D.getBitWidth();
+    unsigned K = D.abs().logBase2();
+    Value *Quot = N;
+    if (K > 0) {
+        // all ones if N is negative, zero otherwise
+        Value *Sign = (K > 1) ? Builder.CreateAShr(N, K - 1, "sign") : N;
+        // 2^k-1 if N is negative, zero otherwise
+        Value *Bias = Builder.CreateLShr(Sign, BitWidth - K, "bias");
+        Value *Biased = Builder.CreateAdd(N, Bias, "biased");
+        Quot = Builder.CreateAShr(Biased, K, "shift");
+    }
+    if (D.isNegative())
+        Quot = Builder.CreateNeg(Quot, "neg");
+    return Quot;
+}
+
+/*
+* Create the instructions for a signed division of N by a constant which is not a power of 2
+*/
+Value *buildSDivMagic(IRBuilder<> &Builder, Value *N, const APInt &D){
+    unsigned BitWidth = D.getBitWidth();
+    SignedMagic M = computeSignedMagic(D);
+    Value *Quot = buildMulHigh(Builder, N, M.Magic, true);
+    // the magic number sign differs from the divisor's one: correct the product with the dividend
+    if (D.isStrictlyPositive() && M.Magic.isNegative())
+        Quot = Builder.CreateAdd(Quot, N, "fixup");
+    else if (D.isNegative() && M.Magic.isStrictlyPositive())
+        Quot = Builder.CreateSub(Quot, N, "fixup");
+    if (M.Shift > 0)
+        Quot = Builder.CreateAShr(Quot, M.Shift, "shift");
+    // add one to negative quotients, so that the result is rounded towards zero
+    Value *Sign = Builder.CreateLShr(Quot, BitWidth - 1, "sign");
+    return Builder.CreateAdd(Quot, Sign, "quot");
+}
+
+/*
+* Create the instructions for an unsigned division of N by a constant which is not a power of 2
+*/
+Value *buildUDivMagic(IRBuilder<> &Builder, Value *N, const APInt &D, unsigned LeadingZeros = 0){
+    // a divisor with the top bit set gives either 0 or 1
+    if (D.isNegative()) {
+        Value *Cmp = Builder.CreateICmpUGE(N, ConstantInt::get(N->getType(), D), "cmp");
+        return Builder.CreateZExt(Cmp, N->getType(), "quot");
+    }
+    UnsignedMagic M = computeUnsignedMagic(D, LeadingZeros);
+    Value *High = buildMulHigh(Builder, N, M.Magic, false);
+    if (!M.IsAdd)
+        return M.Shift > 0 ? Builder.CreateLShr(High, M.Shift, "quot") : High;
+    // the magic number needs one more bit: compute ((N - High) / 2 + High) >> (s-1) to avoid the overflow
+    Value *Diff = Builder.CreateSub(N, High, "diff");
+    Value *Half = Builder.CreateLShr(Diff, 1, "half");
+    Value *Sum = Builder.CreateAdd(Half, High, "sum");
+    return M.Shift > 1 ? Builder.CreateLShr(Sum, M.Shift - 1, "quot") : Sum;
+}
+
+/*
+* Create the instructions for a signed division by a constant (power of 2 or not)
+*/
+Value *buildSDiv(IRBuilder<> &Builder, Value *N, const APInt &D){
+    if (D.isAllOnes())
+        return Builder.CreateNeg(N, "neg");
+    if (D.abs().isPowerOf2())
+        return buildSDivPow2(Builder, N, D);
+    return buildSDivMagic(Builder, N, D);
+}
+
+/*
+* Create the instructions for a signed remainder of N by a (positive or negative) power of 2:
+* the dividend is biased as for the division, the low bits are cleared and the
+* result is subtracted from N, so that the remainder keeps the sign of the dividend
+*/
+Value *buildSRemPow2(IRBuilder<> &Builder, Value *N, const APInt &D){
+    unsigned BitWidth = D.getBitWidth();
+    unsigned K = D.abs().logBase2();
+    if (K == 0)
+        return Constant::getNullValue(N->getType());
+    Value *Sign = (K > 1) ? Builder.CreateAShr(N, K - 1, "sign") : N;
+    Value *Bias = Builder.CreateLShr(Sign, BitWidth - K, "bias");
+    Value *Biased = Builder.CreateAdd(N, Bias, "biased");
+    // clear the low k bits: -2^k is the mask of the high bits
+    APInt HighMask = APInt::getHighBitsSet(BitWidth, BitWidth - K);
+    Value *Rounded = Builder.CreateAnd(Biased, ConstantInt::get(N->getType(), HighMask), "rounded");
+    return Builder.CreateSub(N, Rounded, "rem");
+}
+
+/*
+* Create the instructions for a remainder by a constant from its quotient: N - (N / D) * D
+*/
+Value *buildRemFromQuot(IRBuilder<> &Builder, Value *N, Value *Quot, const APInt &D){
+    Value *Prod = Builder.CreateMul(Quot, ConstantInt::get(N->getType(), D), "prod");
+    return Builder.CreateSub(N, Prod, "rem");
+}
+
+/*
+* Create the shifts and the multiply-high replacing a signed division by a constant
+*/
+Value *SDivReplace(int opNumb, Instruction &I, const APInt *C){
+    IRBuilder<> Builder(&I);
+    Value *Quot = buildSDiv(Builder, I.getOperand(opNumb), *C);
+    return Quot;
+}
+
+/*
+* Create the multiply-high and the shifts replacing an unsigned division by a constant (not a power of 2)
+*/
+Value *UDivReplace(int opNumb, Instruction &I, const APInt *C, unsigned LeadingZeros = 0){
+    IRBuilder<> Builder(&I);
+    Value *Quot = buildUDivMagic(Builder, I.getOperand(opNumb), *C, LeadingZeros);
+    return Quot;
+}
+
+/*
+* Create the instructions replacing a signed remainder by a constant: the sign-corrected mask
+* sequence for powers of 2, a multiply-high division followed by a multiply-subtract otherwise
+*/
+Value *SRemReplace(int opNumb, Instruction &I, const APInt *C){
+    IRBuilder<> Builder(&I);
+    Value *N = I.getOperand(opNumb);
+    const APInt &D = *C;
+    Value *Rem;
+    if (D.abs().isPowerOf2())
+        Rem = buildSRemPow2(Builder, N, D);
+    else
+        Rem = buildRemFromQuot(Builder, N, buildSDiv(Builder, N, D), D);
+    return Rem;
+}
+
+/*
+* Create the multiply-high division followed by a multiply-subtract replacing an unsigned
+* remainder by a constant (not a power of 2)
+*/
+Value *URemReplace(int opNumb, Instruction &I, const APInt *C, unsigned LeadingZeros = 0){
+    IRBuilder<> Builder(&I);
+    Value *N = I.getOperand(opNumb);
+    const APInt &D = *C;
+    Value *Rem = buildRemFromQuot(Builder, N, buildUDivMagic(Builder, N, D, LeadingZeros), D);
+    return Rem;
+}
+
+/*
+* Create the multiplication by the reciprocal replacing a floating point division by a constant:
+* only if the reciprocal is exact (C is a power of 2) or the arcp flag allows an approximation
+*/
+Value *ReciprocalReplace(int opNumb, Instruction &I, const APFloat *C){
+    APFloat Recip(C->getSemantics());
+    if (!C->getExactInverse(&Recip)) {
+        if (!I.hasAllowReciprocal())
+            return nullptr;
+        Recip = APFloat(C->getSemantics(), 1);
+        Recip.divide(*C, APFloat::rmNearestTiesToEven);
+        // do not introduce infinities, zeros or denormals
+        if (!Recip.isNormal())
+            return nullptr;
+    }
+    Instruction *Mul = BinaryOperator::CreateFMul(I.getOperand(opNumb), getFPConstant(I.getType(), Recip), "recip");
+    Mul->copyFastMathFlags(&I);
+    // Insert the mul instruction before the fdiv, it will replace all its uses
+    Mul->insertBefore(&I);
+    return Mul;
+}
+/*
+* Create the fadd replacing a floating point multiplication by 2.0 (x * 2.0 = x + x, exactly)
+*/
+Value *FAddReplace(int opNumb, Instruction &I){
+    Instruction *Add = BinaryOperator::CreateFAdd(I.getOperand(opNumb), I.getOperand(opNumb), "add");
+    Add->copyFastMathFlags(&I);
+    // Insert the add instruction before the fmul, it will replace all its uses
+    Add->insertBefore(&I);
+    return Add;
+}
+
+/*
+*   Strength reduction for vectors of (non uniform) powers of 2: every element of the
+*   constant becomes the amount of an element-wise shift or the element of a mask
+*/
+Value *reducePow2VectorStrength(Instruction &I){
+    unsigned OP = I.getOpcode();
+    int opNumb = 0;
+    SmallVector<Constant*, 8> Logs;
+    if (OP == Instruction::Mul && getPow2VectorElements(I.getOperand(0), Logs)) {
+        opNumb = 1;
+    } else if ((OP == Instruction::Mul || OP == Instruction::UDiv || OP == Instruction::URem || OP == Instruction::SDiv)
+               && getPow2VectorElements(I.getOperand(1), Logs)) {
+        opNumb = 0;
+    } else {
+        return nullptr;
+    }
+    Value *N = I.getOperand(opNumb);
+    Constant *ShAmt = ConstantVector::get(Logs);
+    IRBuilder<> Builder(&I);
+    if (OP == Instruction::Mul)
+        return Builder.CreateShl(N, ShAmt, "shift");
+    if (OP == Instruction::UDiv)
+        return Builder.CreateLShr(N, ShAmt, "shift", I.isExact());
+    unsigned BitWidth = I.getType()->getScalarSizeInBits();
+    if (OP == Instruction::URem) {
+        // d - 1 (the low k bits) in every element
+        SmallVector<Constant*, 8> Masks;
+        for (Constant *Log : Logs)
+            Masks.push_back(ConstantInt::get(Log->getType(), APInt::getLowBitsSet(BitWidth, cast<ConstantInt>(Log)->getZExtValue())));
+        return Builder.CreateAnd(N, ConstantVector::get(Masks), "mask");
+    }
+    // SDiv: the element-wise bias needs a shift by k-1, so division by 1 (or by the sign bit) is not handled
+    SmallVector<Constant*, 8> SignAmt, BiasAmt;
+    for (Constant *Log : Logs) {
+        uint64_t K = cast<ConstantInt>(Log)->getZExtValue();
+        if (K == 0 || K == BitWidth - 1)
+            return nullptr;
+        SignAmt.push_back(ConstantInt::get(Log->getType(), K - 1));
+        BiasAmt.push_back(ConstantInt::get(Log->getType(), BitWidth - K));
+    }
+    Value *Sign = Builder.CreateAShr(N, ConstantVector::get(SignAmt), "sign");
+    Value *Bias = Builder.CreateLShr(Sign, ConstantVector::get(BiasAmt), "bias");
+    Value *Biased = Builder.CreateAdd(N, Bias, "biased");
+    return Builder.CreateAShr(Biased, ShAmt, "shift", I.isExact());
+}
+
+/*
+*   Return the value replacing I if it can be strength reduced, nullptr otherwise
+*   (the new instructions are inserted right before I)
+*/
+Value *reduceStrength(Instruction &I, const TargetTransformInfo &TTI, const ValueFacts &VF){
+    // Vectors of different powers of 2 (the other vector constants are handled as scalars below, if splats)
+    if (Value *V = reducePow2VectorStrength(I)) {
+        return V;
+    }
+    // Check if the instruction is a mul
+    if (I.getOpcode() == Instruction::Mul) {
+// BASE STRENGTH REDUCTION
+        // Get the operands of the instruction
+        const APInt *C1 = getConstantValue(I.getOperand(0));
+        const APInt *C2 = getConstantValue(I.getOperand(1));
+        // Check if the first operand is a power of 2 and the second one is not a constant
+        if ( C1 && !C2 && C1->isPowerOf2() ) {
+            return LShiftReplace(1, I, C1);
+        }
+        // Check if the second operand is a power of 2 and the first one is not a constant
+        else if ( C2 && !C1 && C2->isPowerOf2()) {
+            return LShiftReplace(0, I, C2);
+        }
+// ADVANCED STRENGTH REDUCTION
+        // First operand is a constant power of 2 +1 and -1 and the second one is not a constant
+        else if ( C1 && !C2 && (*C1+1).isPowerOf2() ){
+            return ShiftSubReplace(1, I, C1);
+        }
+        else if ( C1 && !C2 && (*C1-1).isPowerOf2() ){
+            return ShiftAddReplace(1, I, C1);
+        }
+        // Second operand is a constant power of 2 +1 and -1 and the second one is not a constant
+        else if ( C2 && !C1 && (*C2+1).isPowerOf2() ){
+            return ShiftSubReplace(0, I, C2);
+        }
+        else if ( C2 && !C1 && (*C2-1).isPowerOf2() ){
+            return ShiftAddReplace(0, I, C2);
+        }
+        // Any other constant: decompose it in a shift/add/sub chain, if cheaper than the mul
+        else if ( C1 && !C2 && !C1->isZero() ){
+            return MulChainReplace(1, I, C1, TTI);
+        }
+        else if ( C2 && !C1 && !C2->isZero() ){
+            return MulChainReplace(0, I, C2, TTI);
+        }
+    }
+    if ( I.getOpcode() == Instruction::SDiv ){
+// BASE STRENGTH REDUCTION
+        // Get the operands of the instruction
+        const APInt *C1 = getConstantValue(I.getOperand(0));
+        const APInt *C2 = getConstantValue(I.getOperand(1));
+        // Exact division by a positive power of 2: a shift is enough, no rounding is needed
+        if ( C2 && !C1 && I.isExact() && C2->isStrictlyPositive() && C2->isPowerOf2() ) {
+            return RShiftReplace(0, I, C2);
+        }
+        // Non negative dividend and positive divisor: the division is unsigned, no sign fixup is needed
+        else if ( C2 && !C1 && C2->isStrictlyPositive() && isNonNegativeAt(I.getOperand(0), I, VF) ) {
+            return C2->isPowerOf2() ? URShiftReplace(0, I, C2) : UDivReplace(0, I, C2, getLeadingZerosAt(I.getOperand(0), I, VF));
+        }
+// ADVANCED STRENGTH REDUCTION
+        // Check if the second operand is a non zero constant and the first one is not a constant
+        else if ( C2 && !C1 && !C2->isZero() ) {
+            return SDivReplace(0, I, C2);
+        }
+    }
+    if ( I.getOpcode() == Instruction::UDiv ){
+        const APInt *C1 = getConstantValue(I.getOperand(0));
+        const APInt *C2 = getConstantValue(I.getOperand(1));
+// BASE STRENGTH REDUCTION
+        // Check if the second operand is a power of 2 and the first one is not a constant
+        if ( C2 && !C1 && C2->isPowerOf2() ) {
+            return URShiftReplace(0, I, C2);
+        }
+// ADVANCED STRENGTH REDUCTION
+        // Check if the second operand is a non zero constant and the first one is not a constant
+        else if ( C2 && !C1 && !C2->isZero() ) {
+            return UDivReplace(0, I, C2, getLeadingZerosAt(I.getOperand(0), I, VF));
+        }
+    }
+    if ( I.getOpcode() == Instruction::URem ){
+        const APInt *C1 = getConstantValue(I.getOperand(0));
+        const APInt *C2 = getConstantValue(I.getOperand(1));
+// BASE STRENGTH REDUCTION
+        // Check if the second operand is a power of 2 and the first one is not a constant
+        if ( C2 && !C1 && C2->isPowerOf2() ) {
+            return MaskReplace(0, I, C2);
+        }
+// ADVANCED STRENGTH REDUCTION
+        else if ( C2 && !C1 && !C2->isZero() ) {
+            return URemReplace(0, I, C2, getLeadingZerosAt(I.getOperand(0), I, VF));
+        }
+    }
+    if ( I.getOpcode() == Instruction::SRem ){
+        const APInt *C1 = getConstantValue(I.getOperand(0));
+        const APInt *C2 = getConstantValue(I.getOperand(1));
+// ADVANCED STRENGTH REDUCTION
+        // Non negative dividend and positive divisor: the remainder is unsigned
+        if ( C2 && !C1 && C2->isStrictlyPositive() && isNonNegativeAt(I.getOperand(0), I, VF) ) {
+            return C2->isPowerOf2() ? MaskReplace(0, I, C2) : URemReplace(0, I, C2, getLeadingZerosAt(I.getOperand(0), I, VF));
+        }
+        // Check if the second operand is a non zero constant and the first one is not a constant
+        else if ( C2 && !C1 && !C2->isZero() ) {
+            return SRemReplace(0, I, C2);
+        }
+    }
+    if ( I.getOpcode() == Instruction::FDiv ){
+        const APFloat *C1 = getFPConstantValue(I.getOperand(0));
+        const APFloat *C2 = getFPConstantValue(I.getOperand(1));
+        // Division by a constant: multiply by its reciprocal
+        if ( C2 && !C1 && C2->isFiniteNonZero() ) {
+            return ReciprocalReplace(0, I, C2);
+        }
+    }
+    if ( I.getOpcode() == Instruction::FMul ){
+        const APFloat *C1 = getFPConstantValue(I.getOperand(0));
+        const APFloat *C2 = getFPConstantValue(I.getOperand(1));
+        // Multiplication by 2.0: add the operand to itself
+        if ( C1 && !C2 && C1->isExactlyValue(2.0) ) {
+            return FAddReplace(1, I);
+        }
+        else if ( C2 && !C1 && C2->isExactlyValue(2.0) ) {
+            return FAddReplace(0, I);
+        }
+    }
+    return nullptr;
 }
 
 /*
 *     Advanced Strength Reduction Pass
 */
-bool AdvancedStrengthReduction(BasicBlock &B){
+bool AdvancedStrengthReduction(BasicBlock &B, const TargetTransformInfo &TTI, const ValueFacts &VF, SmallVectorImpl<WeakTrackingVH> &DeadInsts){
     outs() << "Advanced Strength Reduction\n";
+    bool Transformed = false;
     for (auto Inst = B.begin(); Inst != B.end(); ++Inst) {
         Instruction &I = *Inst;
         outs() << I << "\n";
-        // Check if the instruction is a mul
-        if (I.getOpcode() == Instruction::Mul) {
-    // BASE STRENGTH REDUCTION
-            // Get the operands of the instruction
-            ConstantInt *C1 = dyn_cast<ConstantInt>(I.getOperand(0));
-            ConstantInt *C2 = dyn_cast<ConstantInt>(I.getOperand(1));
-            // Check if the first operand is a power of 2 and the second one is not a constant
-            if ( C1 && !C2 && C1->getValue().isPowerOf2() ) {
-                LShiftReplace(1, I, C1);
+        if (Value *V = reduceStrength(I, TTI, VF)) {
+            replaceAndTrack(I, V, DeadInsts);
+            Transformed = true;
+        }
+    }
+    return Transformed;
+}
+
+/*
+*   Follow the chain of add/sub with a constant operand defining V and decompose it as
+*   Base + Offset (e.g. ((a + 3) - 1) + 5 -> a + 7). Return the number of instructions in
+*   the chain: C - x is not part of a chain, as it negates x.
+*   The offset wraps around like the instructions do, so flags are not needed
+*/
+unsigned decomposeAddChain(Value *V, Value *&Base, APInt &Offset){
+    unsigned Length = 0;
+    Offset = APInt(V->getType()->getScalarSizeInBits(), 0);
+    Base = V;
+    while (Instruction *Inst = dyn_cast<Instruction>(Base)) {
+        unsigned OP = Inst->getOpcode();
+        if (OP != Instruction::Add && OP != Instruction::Sub) {
+            break;
+        }
+        const APInt *C1 = getConstantValue(Inst->getOperand(0));
+        const APInt *C2 = getConstantValue(Inst->getOperand(1));
+        if (!C1 && C2) {
+            Offset = OP == Instruction::Add ? Offset + *C2 : Offset - *C2;
+            Base = Inst->getOperand(0);
+        } else if (C1 && !C2 && OP == Instruction::Add) {
+            Offset += *C1;
+            Base = Inst->getOperand(1);
+        } else {
+            break;
+        }
+        ++Length;
+    }
+    return Length;
+}
+
+/*
+*   Return an instruction computing Base + Offset which dominates I, nullptr if none.
+*   The chain may have been folded before, even in another basic block
+*/
+Instruction *findDominatingAdd(Value *Base, const APInt &Offset, Instruction &I, const DominatorTree &DT){
+    for (User *U : Base->users()) {
+        Instruction *UserInst = dyn_cast<Instruction>(U);
+        if (!UserInst || UserInst == &I || UserInst->getType() != I.getType() || !DT.dominates(UserInst, &I)) {
+            continue;
+        }
+        Value *UserBase;
+        APInt UserOffset;
+        if (decomposeAddChain(UserInst, UserBase, UserOffset) == 1 && UserBase == Base && UserOffset == Offset) {
+            return UserInst;
+        }
+    }
+    return nullptr;
+}
+
+/*
+*   Return the value replacing I if it ends a chain of add/sub with constant operands,
+*   which is folded into a single add of the sum of the constants, nullptr otherwise
+*/
+Value *reassociateAddChain(Instruction &I, const DominatorTree &DT){
+    Value *Base;
+    APInt Offset;
+    // a single instruction is already folded
+    if (decomposeAddChain(&I, Base, Offset) < 2) {
+        return nullptr;
+    }
+    if (Offset.isZero()) {
+        return Base;
+    }
+    // the same sum may be already computed on every path to I
+    if (Instruction *Add = findDominatingAdd(Base, Offset, I, DT)) {
+        return Add;
+    }
+    Instruction *Add = BinaryOperator::CreateAdd(Base, ConstantInt::get(I.getType(), Offset), "reass");
+    // Insert the add instruction before I, it will replace all its uses
+    Add->insertBefore(&I);
+    return Add;
+}
+
+/*
+*   Return the value replacing I if it is a multiplication or division by a constant
+*   which (partially) cancels the operation defining its operand, nullptr otherwise:
+*   (a * C1) * C2 -> a * (C1 * C2)
+*   (a * C1) / C2 -> a * (C1 / C2) if C2 divides C1 and the mul does not overflow (nsw, nuw)
+*   (a / C2) * C1 -> a * (C1 / C2) if C2 divides C1 and the division is exact
+*/
+Value *cancelMulDiv(Instruction &I){
+    unsigned OP = I.getOpcode();
+    if (OP != Instruction::Mul && OP != Instruction::SDiv && OP != Instruction::UDiv) {
+        return nullptr;
+    }
+    Instruction *DefInst = nullptr;
+    const APInt *C = getConstantValue(I.getOperand(1));
+    if (C && !getConstantValue(I.getOperand(0))) {
+        DefInst = dyn_cast<Instruction>(I.getOperand(0));
+    } else if (OP == Instruction::Mul && (C = getConstantValue(I.getOperand(0))) && !getConstantValue(I.getOperand(1))) {
+        DefInst = dyn_cast<Instruction>(I.getOperand(1));
+    }
+    if (!DefInst || !isa<BinaryOperator>(DefInst) || C->isZero()) {
+        return nullptr;
+    }
+    unsigned DefOP = DefInst->getOpcode();
+    // the non constant operand of the defining instruction and its constant
+    Value *Base = nullptr;
+    const APInt *DefC = getConstantValue(DefInst->getOperand(1));
+    if (DefC && !getConstantValue(DefInst->getOperand(0))) {
+        Base = DefInst->getOperand(0);
+    } else if (DefOP == Instruction::Mul && (DefC = getConstantValue(DefInst->getOperand(0))) && !getConstantValue(DefInst->getOperand(1))) {
+        Base = DefInst->getOperand(1);
+    }
+    if (!Base || DefC->isZero()) {
+        return nullptr;
+    }
+
+    // the constant a is multiplied by
+    APInt Factor;
+    if (OP == Instruction::Mul && DefOP == Instruction::Mul) {
+        Factor = *DefC * *C;
+    }
+    else if (OP == Instruction::SDiv && DefOP == Instruction::Mul && DefInst->hasNoSignedWrap()
+        && DefC->srem(*C).isZero() && !(DefC->isMinSignedValue() && C->isAllOnes())) {
+        Factor = DefC->sdiv(*C);
+    }
+    else if (OP == Instruction::UDiv && DefOP == Instruction::Mul && DefInst->hasNoUnsignedWrap()
+        && DefC->urem(*C).isZero()) {
+        Factor = DefC->udiv(*C);
+    }
+    else if (OP == Instruction::Mul && DefOP == Instruction::SDiv && DefInst->isExact()
+        && C->srem(*DefC).isZero() && !(C->isMinSignedValue() && DefC->isAllOnes())) {
+        Factor = C->sdiv(*DefC);
+    }
+    else if (OP == Instruction::Mul && DefOP == Instruction::UDiv && DefInst->isExact()
+        && C->urem(*DefC).isZero()) {
+        Factor = C->udiv(*DefC);
+    }
+    else {
+        return nullptr;
+    }
+
+    if (Factor.isOne()) {
+        return Base;
+    }
+    Instruction *Mul = BinaryOperator::CreateMul(Base, ConstantInt::get(I.getType(), Factor), "reass");
+    // Insert the mul instruction before I, it will replace all its uses
+    Mul->insertBefore(&I);
+    return Mul;
+}
+
+/*
+*   Return the value replacing I if it can be reassociated with the instructions defining
+*   its operands (see reassociateAddChain and cancelMulDiv), nullptr otherwise
+*/
+Value *reassociateConstants(Instruction &I, const DominatorTree &DT){
+    if (Value *V = reassociateAddChain(I, DT)) {
+        return V;
+    }
+    return cancelMulDiv(I);
+}
+
+/*
+ *  Multi-Instruction Optimization: the basic blocks are visited in dominator tree preorder,
+ *  so the operands of an instruction are folded before the instruction itself
+*/
+bool MultiInstructionOptimization(Function &F, const DominatorTree &DT, SmallVectorImpl<WeakTrackingVH> &DeadInsts){
+    outs() << "Multi-Instruction Optimization\n";
+    bool Transformed = false;
+    for (const DomTreeNode *Node : depth_first(DT.getRootNode())) {
+        // For all intructions in the basic block
+        for (Instruction& I : *Node->getBlock()){
+            outs() << I << "\n";
+            if (Value *Substitute = reassociateConstants(I, DT)) {
+                outs() << "Substitute" << I << " with ";
+                Substitute->printAsOperand(outs(), false);
+                outs() << "\n";
+                replaceAndTrack(I, Substitute, DeadInsts);
+                Transformed = true;
+            }
+        }
+    }
+    return Transformed;
+}
+
+/*
+*  Peephole Optimization: algebraic identities, strength reduction and multi-instruction
+*  optimization driven by a worklist, in two phases. In each phase, when an instruction is
+*  rewritten its users and the new instructions are visited again, until a fixed point.
+*  The first phase applies the identities, the range facts and the reassociation, the second adds
+*  strength reduction: a mul turned into shifts can no longer be reassociated with its
+*  users (e.g. (a * 4) / 4), so the reassociations are all done before
+*/
+bool PeepholeOptimization(Function &F, const TargetTransformInfo &TTI, const ValueFacts &VF, SmallVectorImpl<WeakTrackingVH> &DeadInsts){
+    outs() << "Peephole Optimization\n";
+    bool Transformed = false;
+    for (bool ReduceStrength : {false, true}) {
+        SmallSetVector<Instruction*, 64> Worklist;
+        // instructions are popped from the back: push them in reverse order to visit them top-down
+        for (BasicBlock *B : post_order(&F.getEntryBlock())) {
+            for (Instruction &I : reverse(*B)) {
+                Worklist.insert(&I);
+            }
+        }
+
+        while (!Worklist.empty()) {
+            Instruction *I = Worklist.pop_back_val();
+            // a dead instruction is not worth rewriting
+            if (isInstructionTriviallyDead(I)) {
+                continue;
+            }
+            Instruction *Prev = I->getPrevNode();
+            Value *V = simplifyAlgebraicIdentity(*I);
+            if (!V) {
+                V = simplifyByRange(*I, VF);
             }
-            // Check if the second operand is a power of 2 and the first one is not a constant
-            else if ( C2 && !C1 && C2->getValue().isPowerOf2()) {
-                LShiftReplace(0, I, C2);
+            if (!V) {
+                V = reassociateConstants(*I, VF.DT);
             }
-    // ADVANCED STRENGTH REDUCTION
-            // First operand is a constant power of 2 +1 and -1 and the second one is not a constant
-            else if ( C1 && !C2 && (C1->getValue()+1).isPowerOf2() ){
-                ShiftSubReplace(1, I, C1);
+            if (!V && ReduceStrength) {
+                V = reduceStrength(*I, TTI, VF);
             }
-            else if ( C1 && !C2 && (C1->getValue()-1).isPowerOf2() ){
-                ShiftAddReplace(1, I, C1);
+            if (!V) {
+                continue;
             }
-            // Second operand is a constant power of 2 +1 and -1 and the second one is not a constant
-            else if ( C2 && !C1 && (C2->getValue()+1).isPowerOf2() ){
-                ShiftSubReplace(0, I, C2);
+            outs() << "Replace" << *I << " with ";
+            V->printAsOperand(outs(), false);
+            outs() << "\n";
+
+            // the instructions created before I may be simplified further
+            for (Instruction *New = Prev ? Prev->getNextNode() : &I->getParent()->front(); New != I; New = New->getNextNode()) {
+                Worklist.insert(New);
             }
-            else if ( C2 && !C1 && (C2->getValue()-1).isPowerOf2() ){
-                ShiftAddReplace(0, I, C2);
+            // the users of I see a new operand
+            for (User *U : I->users()) {
+                if (Instruction *UserInst = dyn_cast<Instruction>(U)) {
+                    Worklist.insert(UserInst);
+                }
             }
+            replaceAndTrack(*I, V, DeadInsts);
+            Transformed = true;
+        }
+    }
+    return Transformed;
+}
+
+/*
+*   Return the funnel shift replacing I if it is a rotate written with shifts, nullptr otherwise:
+*   x << k | x >> (W - k)                     -> fshl(x, x, k)   (constant k)
+*   x << s | x >> (W - s)                     -> fshl(x, x, s)
+*   x << (s & (W - 1)) | x >> (-s & (W - 1))  -> fshl(x, x, s)
+*   and the same with the roles of the shifts swapped (fshr)
+*/
+Value *matchRotate(Instruction &I){
+    using namespace PatternMatch;
+    Value *X, *ShlAmt, *LShrAmt;
+    if (!match(&I, m_c_Or(m_Shl(m_Value(X), m_Value(ShlAmt)), m_LShr(m_Deferred(X), m_Value(LShrAmt))))) {
+        return nullptr;
+    }
+    unsigned BitWidth = I.getType()->getScalarSizeInBits();
+    Intrinsic::ID ID = Intrinsic::not_intrinsic;
+    Value *Amt = nullptr;
+    const APInt *C1, *C2;
+    Value *S;
+    // constant shift amounts adding up to the width
+    if (match(ShlAmt, m_APInt(C1)) && match(LShrAmt, m_APInt(C2))) {
+        if (C1->ult(BitWidth) && C2->ult(BitWidth) && C1->getZExtValue() + C2->getZExtValue() == BitWidth) {
+            ID = Intrinsic::fshl;
+            Amt = ShlAmt;
         }
-        if ( I.getOpcode() == Instruction::SDiv ){
-    // BASE STRENGTH REDUCTION
-            // Get the operands of the instruction
-            ConstantInt *C1 = dyn_cast<ConstantInt>(I.getOperand(0));
-            ConstantInt *C2 = dyn_cast<ConstantInt>(I.getOperand(1));
-            // Check if the second operand is a power of 2 and the first one is not a constant
-            if ( C2 && !C1 && C2->getValue().isPowerOf2()) {
-                RShiftReplace(0, I, C2);
+    }
+    else if (match(LShrAmt, m_Sub(m_SpecificInt(BitWidth), m_Specific(ShlAmt)))) {
+        ID = Intrinsic::fshl;
+        Amt = ShlAmt;
+    }
+    else if (match(ShlAmt, m_Sub(m_SpecificInt(BitWidth), m_Specific(LShrAmt)))) {
+        ID = Intrinsic::fshr;
+        Amt = LShrAmt;
+    }
+    // masked amounts never shift by the width, the funnel shift takes them modulo the width
+    else if (isPowerOf2_32(BitWidth) && match(ShlAmt, m_And(m_Value(S), m_SpecificInt(BitWidth - 1)))
+        && match(LShrAmt, m_And(m_Neg(m_Specific(S)), m_SpecificInt(BitWidth - 1)))) {
+        ID = Intrinsic::fshl;
+        Amt = S;
+    }
+    else if (isPowerOf2_32(BitWidth) && match(LShrAmt, m_And(m_Value(S), m_SpecificInt(BitWidth - 1)))
+        && match(ShlAmt, m_And(m_Neg(m_Specific(S)), m_SpecificInt(BitWidth - 1)))) {
+        ID = Intrinsic::fshr;
+        Amt = S;
+    }
+    if (!Amt) {
+        return nullptr;
+    }
+    IRBuilder<> Builder(&I);
+    return Builder.CreateIntrinsic(ID, {I.getType()}, {X, X, Amt}, nullptr, "rot");
+}
+
+/*
+*   Return y if X is the mask of the trailing zeros of y, (y & -y) - 1 or ~y & (y - 1),
+*   nullptr otherwise: its population count is the number of trailing zeros of y (W for y = 0)
+*/
+Value *getTrailingZerosMaskSource(Value *X){
+    using namespace PatternMatch;
+    Value *Y;
+    if (match(X, m_Add(m_c_And(m_Neg(m_Value(Y)), m_Deferred(Y)), m_AllOnes()))
+        || match(X, m_c_And(m_Not(m_Value(Y)), m_Add(m_Deferred(Y), m_AllOnes())))) {
+        return Y;
+    }
+    return nullptr;
+}
+
+/*
+*   Create the population count of X, a cttz if X is a trailing zeros mask
+*/
+Value *createPopCount(IRBuilder<> &Builder, Value *X){
+    if (Value *Y = getTrailingZerosMaskSource(X)) {
+        return Builder.CreateIntrinsic(Intrinsic::cttz, {X->getType()}, {Y, Builder.getFalse()}, nullptr, "cttz");
+    }
+    return Builder.CreateUnaryIntrinsic(Intrinsic::ctpop, X, nullptr, "ctpop");
+}
+
+/*
+*   Return the ctpop replacing I if it ends the SWAR population count, nullptr otherwise:
+*   x1 = x - ((x >> 1) & 0x55..55)
+*   x2 = (x1 & 0x33..33) + ((x1 >> 2) & 0x33..33)
+*   x3 = (x2 + (x2 >> 4)) & 0x0F..0F
+*   I  = (x3 * 0x01..01) >> (W - 8)
+*/
+Value *matchPopCount(Instruction &I){
+    using namespace PatternMatch;
+    unsigned BitWidth = I.getType()->getScalarSizeInBits();
+    if (!I.getType()->isIntOrIntVectorTy() || BitWidth % 8 != 0 || BitWidth > 128) {
+        return nullptr;
+    }
+    APInt Mask55 = APInt::getSplat(BitWidth, APInt(8, 0x55));
+    APInt Mask33 = APInt::getSplat(BitWidth, APInt(8, 0x33));
+    APInt Mask0F = APInt::getSplat(BitWidth, APInt(8, 0x0F));
+    APInt Mask01 = APInt::getSplat(BitWidth, APInt(8, 0x01));
+    Value *X3, *X2, *X1, *X;
+    if (match(&I, m_LShr(m_Mul(m_Value(X3), m_SpecificInt(Mask01)), m_SpecificInt(BitWidth - 8)))
+        && match(X3, m_And(m_c_Add(m_LShr(m_Value(X2), m_SpecificInt(4)), m_Deferred(X2)), m_SpecificInt(Mask0F)))
+        && match(X2, m_c_Add(m_And(m_Value(X1), m_SpecificInt(Mask33)), m_And(m_LShr(m_Deferred(X1), m_SpecificInt(2)), m_SpecificInt(Mask33))))
+        && match(X1, m_Sub(m_Value(X), m_And(m_LShr(m_Deferred(X), m_SpecificInt(1)), m_SpecificInt(Mask55))))) {
+        IRBuilder<> Builder(&I);
+        return createPopCount(Builder, X);
+    }
+    return nullptr;
+}
+
+/*
+*   Return the cttz replacing I if it is the ctpop of a trailing zero mask, nullptr otherwise
+*/
+Value *matchTrailingZeros(Instruction &I){
+    using namespace PatternMatch;
+    Value *X;
+    if (!match(&I, m_Intrinsic<Intrinsic::ctpop>(m_Value(X))) || !getTrailingZerosMaskSource(X)) {
+        return nullptr;
+    }
+    IRBuilder<> Builder(&I);
+    return createPopCount(Builder, X);
+}
+
+/*
+*   Return the bswap replacing I if it is the root of a tree of ors assembling the bytes of
+*   a value in reverse order, nullptr otherwise
+*/
+Value *matchByteSwap(Instruction &I){
+    if (I.getOpcode() != Instruction::Or) {
+        return nullptr;
+    }
+    // the inner ors are only a part of the swap
+    for (User *U : I.users()) {
+        if (Instruction *UserInst = dyn_cast<Instruction>(U)) {
+            if (UserInst->getOpcode() == Instruction::Or) {
+                return nullptr;
             }
         }
     }
-    return true;
+    SmallVector<Instruction*, 4> InsertedInsts;
+    if (!recognizeBSwapOrBitReverseIdiom(&I, /*MatchBSwaps*/ true, /*MatchBitReversals*/ false, InsertedInsts)) {
+        return nullptr;
+    }
+    return InsertedInsts.back();
 }
 
 /*
- *  Multi-Instruction Optimization
+*   Return the intrinsic replacing I if it is a bit manipulation idiom, nullptr otherwise
 */
-bool MultiInstructionOptimization(BasicBlock &B){
-    outs() << "Multi-Instruction Optimization\n";
-    // For all intructions in the basic block
-    for (Instruction& I : B){
+Value *recognizeBitIdiom(Instruction &I){
+    if (!I.getType()->isIntOrIntVectorTy()) {
+        return nullptr;
+    }
+    if (Value *V = matchRotate(I)) {
+        return V;
+    }
+    if (Value *V = matchPopCount(I)) {
+        return V;
+    }
+    if (Value *V = matchTrailingZeros(I)) {
+        return V;
+    }
+    return matchByteSwap(I);
+}
+
+/*
+*   Bit Idiom Recognition Pass: rotates, byte swaps, population counts and trailing zero
+*   counts written with shifts and masks are replaced with the LLVM intrinsics
+*/
+bool BitIdiomRecognition(BasicBlock &B, SmallVectorImpl<WeakTrackingVH> &DeadInsts){
+    outs() << "Bit Idiom Recognition\n";
+    bool Transformed = false;
+    for (Instruction &I : B) {
         outs() << I << "\n";
-        // Check if instruction is a binary operation of interest (add, sub)
-        unsigned int OP = I.getOpcode();
-        // Check if the instruction is an add OR sub
-        if (OP == Instruction::Add || OP == Instruction::Sub) {
-            // Operands of the instruction
-            Value *RHS1 = I.getOperand(0);
-            Value *RHS2 = I.getOperand(1);
-            // Cast the operands to ConstantInt
-            ConstantInt *C1 = dyn_cast<ConstantInt>(RHS1);
-            ConstantInt *C2 = dyn_cast<ConstantInt>(RHS2);
-            // The non constant operand
-            Value* Substitute = nullptr;
-            // The constant operand
-            ConstantInt* ConstantOp = nullptr;
-            // Check if only one of the operands is a constant
-            if (C1 && !C2 && OP != Instruction::Sub) {
-                Substitute = RHS2;
-                ConstantOp = C1;
-            } else if (!C1 && C2) {
-                Substitute = RHS1;
-                ConstantOp = C2;
-            } else { // If both operands are constants or both are not constants
-                continue; 
-            }
-            // Iterate over all users of the instruction
-            for (auto Iter = I.user_begin(); Iter != I.user_end(); ++Iter) {
-                Instruction* UserInst = dyn_cast<Instruction>(*Iter);
-                // Skip iteration if the user inst is not a binary operation
-                if ( !UserInst->isBinaryOp() ) {
-                    continue;
-                }
-                // cast the operands of the user instruction to ConstantInt
-                ConstantInt *UserC1 = dyn_cast<ConstantInt>(UserInst->getOperand(0));
-                ConstantInt *UserC2 = dyn_cast<ConstantInt>(UserInst->getOperand(1));
-                // check if the instruction are opposite and the constant value is the same
-                if ( areOppositeOps(OP,UserInst->getOpcode()) &&
-                ( ( UserC2 && (UserC2->getValue() == ConstantOp->getValue() ) ) || ( UserC1 && ( UserC1->getValue() == ConstantOp->getValue() ) && UserInst->getOpcode() != Instruction::Sub) ) ) {
-                    outs() << "Substitute" << *UserInst << " with ";
-                    Substitute->printAsOperand(outs(), false);
-                    outs() << "\n";
-                    UserInst->replaceAllUsesWith(Substitute);
-                }
-            }
+        if (Value *V = recognizeBitIdiom(I)) {
+            outs() << "Replace" << I << " with" << *V << "\n";
+            replaceAndTrack(I, V, DeadInsts);
+            Transformed = true;
         }
     }
-    return true;
+    return Transformed;
 }
 
 /*
@@ -223,30 +1359,62 @@ bool MultiInstructionOptimization(BasicBlock &B){
 enum {
     AlgId = 1,
     AdvStrRed = 2,
-    MultiInstOpt = 3
+    MultiInstOpt = 3,
+    Peephole = 4,
+    BitIdiom = 5
 };
 
-bool runOnFunction(Function &F, int passNumb) {
+bool runOnFunction(Function &F, int passNumb, FunctionAnalysisManager &AM) {
     bool Transformed = false;
+    // Target cost model, used to decide wether a strength reduction is profitable
+    const TargetTransformInfo &TTI = AM.getResult<TargetIRAnalysis>(F);
+    // Replaced instructions, erased in a single batch once all the blocks have been visited
+    SmallVector<WeakTrackingVH, 16> DeadInsts;
+    // Used to reuse values computed in dominating blocks
+    const DominatorTree &DT = AM.getResult<DominatorTreeAnalysis>(F);
+    // Known bits and ranges, used to pick unsigned sequences and to fold comparisons
+    ValueFacts VF = {F.getParent()->getDataLayout(), AM.getResult<AssumptionAnalysis>(F), DT, AM.getResult<LazyValueAnalysis>(F)};
+    // The peephole and multi-instruction optimizations work on the whole function at once
+    if (passNumb == Peephole) {
+        Transformed = PeepholeOptimization(F, TTI, VF, DeadInsts);
+    }
+    else if (passNumb == MultiInstOpt) {
+        Transformed = MultiInstructionOptimization(F, DT, DeadInsts);
+    }
     // Iterate over all basic blocks in the function
-    for (auto Iter = F.begin(); Iter != F.end(); ++Iter) {
-        if ( (passNumb == AlgId) && AlgebraicIdentity(*Iter))
+    for (auto Iter = F.begin(); passNumb != Peephole && passNumb != MultiInstOpt && Iter != F.end(); ++Iter) {
+        if ( (passNumb == AlgId) && AlgebraicIdentity(*Iter, VF, DeadInsts))
         {
             Transformed = true;
         }
-        else if ( (passNumb == AdvStrRed) && AdvancedStrengthReduction(*Iter))
+        else if ( (passNumb == AdvStrRed) && AdvancedStrengthReduction(*Iter, TTI, VF, DeadInsts))
         {
             Transformed = true;
         }
-        else if ( (passNumb == MultiInstOpt) && MultiInstructionOptimization(*Iter))
+        else if ( (passNumb == BitIdiom) && BitIdiomRecognition(*Iter, DeadInsts))
         {
             Transformed = true;
         }
     }
 
+    // Erase the replaced instructions, and their operands when they become dead in turn
+    RecursivelyDeleteTriviallyDeadInstructionsPermissive(DeadInsts);
+
     return Transformed;
 }
 
+/*
+*  Analyses preserved by the passes: instructions are replaced and erased, but the CFG
+*  is left untouched
+*/
+PreservedAnalyses getPreserved(bool Changed) {
+    if (!Changed)
+        return PreservedAnalyses::all();
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    return PA;
+}
+
 
 //-----------------------------------------------------------------------------
 // Pass implementation
@@ -254,27 +1422,40 @@ bool runOnFunction(Function &F, int passNumb) {
 namespace {
     // First pass ( Algebraic Identity )
     struct As01Pass1: PassInfoMixin<As01Pass1> {
-    PreservedAnalyses run(Function &F, FunctionAnalysisManager &) {
-        bool res = runOnFunction(F, AlgId);
-        return PreservedAnalyses::all();
+    PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM) {
+        return getPreserved(runOnFunction(F, AlgId, AM));
     }
     static bool isRequired() { return true; }
     };
 
     // Second pass ( Advanced Strength Reduction )
     struct As01Pass2: PassInfoMixin<As01Pass2> {
-        PreservedAnalyses run(Function &F, FunctionAnalysisManager &) {
-            bool res = runOnFunction(F, AdvStrRed);
-            return PreservedAnalyses::all();
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM) {
+            return getPreserved(runOnFunction(F, AdvStrRed, AM));
     }
         static bool isRequired() { return true; }
     };
 
     // Third pass ( Multi-Instruction Optimization )
     struct As01Pass3: PassInfoMixin<As01Pass3> {
-        PreservedAnalyses run(Function &F, FunctionAnalysisManager &) {
-            bool res = runOnFunction(F, MultiInstOpt);
-            return PreservedAnalyses::all();
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM) {
+            return getPreserved(runOnFunction(F, MultiInstOpt, AM));
+    }
+        static bool isRequired() { return true; }
+    };
+
+    // Fourth pass ( Peephole Optimization, all of the above to a fixed point )
+    struct As01Pass4: PassInfoMixin<As01Pass4> {
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM) {
+            return getPreserved(runOnFunction(F, Peephole, AM));
+    }
+        static bool isRequired() { return true; }
+    };
+
+    // Fifth pass ( Bit Idiom Recognition )
+    struct As01Pass5: PassInfoMixin<As01Pass5> {
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM) {
+            return getPreserved(runOnFunction(F, BitIdiom, AM));
     }
         static bool isRequired() { return true; }
     };
@@ -295,6 +1476,11 @@ llvm::PassPluginLibraryInfo getTestPassPluginInfo() {
                         FPM.addPass(As01Pass1());
                         return true;
                     }
+                    // Bit Idiom Recognition
+                    if ( Name == "bit-idiom" ){
+                        FPM.addPass(As01Pass5());
+                        return true;
+                    }
                     // Advanced Strength Reduction
                     if ( Name == "adv-str-red" ){
                         FPM.addPass(As01Pass2());
@@ -305,6 +1491,11 @@ llvm::PassPluginLibraryInfo getTestPassPluginInfo() {
                         FPM.addPass(As01Pass3());
                         return true;
                     }
+                    // Peephole Optimization (all of the above, worklist driven)
+                    if ( Name == "peephole-opt" ){
+                        FPM.addPass(As01Pass4());
+                        return true;
+                    }
                     return false;
                 });
           }};
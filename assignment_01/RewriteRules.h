@@ -0,0 +1,218 @@
+#ifndef AS01_REWRITE_RULES_H
+#define AS01_REWRITE_RULES_H
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/PatternMatch.h"
+
+/*
+*   Table driven rewrite rules on binary operators.
+*   A rule is a type, matched against the operands (X, Y) of an instruction:
+*
+*       Rule<Opcode, Pattern, Result [, Requirement]>
+*
+*   e.g. Rule<Instruction::Add, ConstInt<is_zero_int>, ReturnX> is x + 0 -> x.
+*   The rules are expanded at compile time by RuleTable: an instruction costs one switch on
+*   its opcode, and only the rules of that opcode are tried. Rules of commutative opcodes
+*   are tried with the operands in both orders, so 0 + x -> x comes for free
+*/
+namespace rewrite {
+
+using namespace llvm;
+
+/*
+*   Opcodes whose rules are also tried with swapped operands
+*/
+constexpr bool isCommutativeOpcode(unsigned Opc) {
+    return Opc == Instruction::Add || Opc == Instruction::Mul || Opc == Instruction::And
+        || Opc == Instruction::Or || Opc == Instruction::Xor || Opc == Instruction::FAdd
+        || Opc == Instruction::FMul;
+}
+
+//-----------------------------------------------------------------------------
+// Patterns: match(X, Y) on the (possibly swapped) operands of the instruction
+//-----------------------------------------------------------------------------
+/*
+*   Y is an integer constant (or splat vector) satisfying the PatternMatch predicate Pred
+*   (e.g. PatternMatch::is_zero_int, PatternMatch::is_one, PatternMatch::is_all_ones)
+*/
+template <typename Pred>
+struct ConstInt {
+    static bool match(Value *, Value *Y) {
+        return PatternMatch::match(Y, PatternMatch::cst_pred_ty<Pred>());
+    }
+};
+
+/*
+*   Y is a floating point constant (or splat vector) satisfying the predicate Pred
+*/
+template <typename Pred>
+struct ConstFP {
+    static bool match(Value *, Value *Y) {
+        return PatternMatch::match(Y, PatternMatch::cstfp_pred_ty<Pred>());
+    }
+};
+
+/*
+*   Both operands are the same value
+*/
+struct SameOperands {
+    static bool match(Value *X, Value *Y) { return X == Y; }
+};
+
+/*
+*   Floating point 1.0, missing among the PatternMatch predicates
+*/
+struct is_one_fp {
+    bool isValue(const APFloat &C) { return C.isExactlyValue(1.0); }
+};
+
+//-----------------------------------------------------------------------------
+// Results: the value replacing the instruction
+//-----------------------------------------------------------------------------
+// The other operand (identity element)
+struct ReturnX {
+    static Value *get(BinaryOperator &, Value *X, Value *) { return X; }
+};
+// The constant operand (absorbing element)
+struct ReturnY {
+    static Value *get(BinaryOperator &, Value *, Value *Y) { return Y; }
+};
+// Zero of the instruction type
+struct ReturnZero {
+    static Value *get(BinaryOperator &I, Value *, Value *) { return Constant::getNullValue(I.getType()); }
+};
+
+//-----------------------------------------------------------------------------
+// Requirements: flags of the instruction the rule depends on
+//-----------------------------------------------------------------------------
+struct Always {
+    static bool holds(BinaryOperator &) { return true; }
+};
+struct NoSignedZeros {
+    static bool holds(BinaryOperator &I) { return I.hasNoSignedZeros(); }
+};
+
+/*
+*   A rewrite rule: an instruction with opcode Opc whose operands match Pattern is replaced
+*   with Result, if Requirement holds
+*/
+template <unsigned Opc, typename Pattern, typename Result, typename Requirement = Always>
+struct Rule {
+    static constexpr unsigned Opcode = Opc;
+    static Value *apply(BinaryOperator &I, Value *X, Value *Y) {
+        if (!Pattern::match(X, Y)) {
+            return nullptr;
+        }
+        return Result::get(I, X, Y);
+    }
+    static bool holds(BinaryOperator &I) { return Requirement::holds(I); }
+};
+
+/*
+*   The set of rules, dispatched on the opcode of the instruction
+*/
+template <typename... Rules>
+struct RuleTable {
+    /*
+    *   Return the value equivalent to I according to the first matching rule, nullptr if none
+    */
+    static Value *simplify(Instruction &I) {
+        BinaryOperator *BO = dyn_cast<BinaryOperator>(&I);
+        if (!BO) {
+            return nullptr;
+        }
+        switch (I.getOpcode()) {
+#define HANDLE_BINARY_INST(N, OPC, CLASS) \
+        case Instruction::OPC: return simplifyOpcode<Instruction::OPC>(*BO);
+#include "llvm/IR/Instruction.def"
+        default:
+            return nullptr;
+        }
+    }
+
+private:
+    /*
+    *   Try the rules of opcode Opc in order: the others are discarded at compile time
+    */
+    template <unsigned Opc>
+    static Value *simplifyOpcode(BinaryOperator &I) {
+        Value *V = nullptr;
+        (void)((V = tryRule<Opc, Rules>(I)) || ...);
+        return V;
+    }
+
+    template <unsigned Opc, typename R>
+    static Value *tryRule(BinaryOperator &I) {
+        if constexpr (R::Opcode != Opc) {
+            return nullptr;
+        } else {
+            if (!R::holds(I)) {
+                return nullptr;
+            }
+            if (Value *V = R::apply(I, I.getOperand(0), I.getOperand(1))) {
+                return V;
+            }
+            if constexpr (isCommutativeOpcode(Opc)) {
+                return R::apply(I, I.getOperand(1), I.getOperand(0));
+            }
+            return nullptr;
+        }
+    }
+};
+
+using PatternMatch::is_zero_int;
+using PatternMatch::is_one;
+using PatternMatch::is_all_ones;
+using PatternMatch::is_pos_zero_fp;
+using PatternMatch::is_neg_zero_fp;
+
+/*
+*   Algebraic identities of the As01 passes.
+*   Only the constant on the right is matched for non commutative opcodes (0 - x, 1 / x
+*   are not identities); identities which do not hold for signed zeros need nsz
+*/
+typedef RuleTable<
+    // x + 0 = x, x - 0 = x
+    Rule<Instruction::Add, ConstInt<is_zero_int>, ReturnX>,
+    Rule<Instruction::Sub, ConstInt<is_zero_int>, ReturnX>,
+    // x - x = 0
+    Rule<Instruction::Sub, SameOperands, ReturnZero>,
+    // x * 1 = x, x / 1 = x, x * 0 = 0
+    Rule<Instruction::Mul, ConstInt<is_one>, ReturnX>,
+    Rule<Instruction::Mul, ConstInt<is_zero_int>, ReturnY>,
+    Rule<Instruction::SDiv, ConstInt<is_one>, ReturnX>,
+    Rule<Instruction::UDiv, ConstInt<is_one>, ReturnX>,
+    // x % 1 = 0
+    Rule<Instruction::SRem, ConstInt<is_one>, ReturnZero>,
+    Rule<Instruction::URem, ConstInt<is_one>, ReturnZero>,
+    // shifts by 0
+    Rule<Instruction::Shl, ConstInt<is_zero_int>, ReturnX>,
+    Rule<Instruction::LShr, ConstInt<is_zero_int>, ReturnX>,
+    Rule<Instruction::AShr, ConstInt<is_zero_int>, ReturnX>,
+    // x & -1 = x, x & 0 = 0, x & x = x
+    Rule<Instruction::And, ConstInt<is_all_ones>, ReturnX>,
+    Rule<Instruction::And, ConstInt<is_zero_int>, ReturnY>,
+    Rule<Instruction::And, SameOperands, ReturnX>,
+    // x | 0 = x, x | -1 = -1, x | x = x
+    Rule<Instruction::Or, ConstInt<is_zero_int>, ReturnX>,
+    Rule<Instruction::Or, ConstInt<is_all_ones>, ReturnY>,
+    Rule<Instruction::Or, SameOperands, ReturnX>,
+    // x ^ 0 = x, x ^ x = 0
+    Rule<Instruction::Xor, ConstInt<is_zero_int>, ReturnX>,
+    Rule<Instruction::Xor, SameOperands, ReturnZero>,
+    // x + -0.0 = x, x + 0.0 = x only if x is not -0.0
+    Rule<Instruction::FAdd, ConstFP<is_neg_zero_fp>, ReturnX>,
+    Rule<Instruction::FAdd, ConstFP<is_pos_zero_fp>, ReturnX, NoSignedZeros>,
+    // x - 0.0 = x, x - -0.0 = x only if x is not -0.0
+    Rule<Instruction::FSub, ConstFP<is_pos_zero_fp>, ReturnX>,
+    Rule<Instruction::FSub, ConstFP<is_neg_zero_fp>, ReturnX, NoSignedZeros>,
+    // x * 1.0 = x, x / 1.0 = x
+    Rule<Instruction::FMul, ConstFP<is_one_fp>, ReturnX>,
+    Rule<Instruction::FDiv, ConstFP<is_one_fp>, ReturnX>
+> AlgebraicIdentityRules;
+
+} // namespace rewrite
+
+#endif // AS01_REWRITE_RULES_H
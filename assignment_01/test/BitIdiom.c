@@ -0,0 +1,22 @@
+unsigned rotl(unsigned x, unsigned k) {
+    return (x << k) | (x >> (32 - k));
+}
+
+unsigned rotl5(unsigned x) {
+    return (x << 5) | (x >> 27);
+}
+
+unsigned bswap(unsigned x) {
+    return (x << 24) | ((x << 8) & 0x00ff0000) | ((x >> 8) & 0x0000ff00) | (x >> 24);
+}
+
+unsigned popcount(unsigned x) {
+    x = x - ((x >> 1) & 0x55555555);
+    x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+    x = (x + (x >> 4)) & 0x0f0f0f0f;
+    return (x * 0x01010101) >> 24;
+}
+
+int ctz(unsigned x) {
+    return __builtin_popcount((x & -x) - 1);
+}
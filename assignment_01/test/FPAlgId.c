@@ -0,0 +1,13 @@
+float fpAlgIdentity(float b) {
+    float a = b + -0.0f;
+    float c = a - 0.0f;
+    float d = c * 1.0f;
+    return d / 1.0f;
+}
+
+double fpStrRed(double b) {
+    double a = b / 8.0;
+    double c = a * 2.0;
+    // exact only with -freciprocal-math (arcp)
+    return c / 3.0;
+}
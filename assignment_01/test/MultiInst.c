@@ -20,4 +20,27 @@ int multiInst4(int b) {
     int a = b - 1;
     int c = a + 1;
     return c;
-}
\ No newline at end of file
+}
+int multiInstChain(int b) {
+    int a = b + 3;
+    int c = a - 1;
+    int d = c + 5;
+    return d;
+}
+
+int multiInstMulDiv(int b) {
+    // signed overflow is undefined: the mul is nsw
+    int a = b * 12;
+    int c = a / 4;
+    return c;
+}
+
+int multiInstDom(int b, int cond) {
+    int a = b + 7;
+    if (cond) {
+        int c = b + 6;
+        // b + 7 is already computed in the dominating block
+        return (c + 1) * a;
+    }
+    return a;
+}
@@ -0,0 +1,9 @@
+int peephole(int b) {
+    int a = b + 0;
+    int c = a * 8;
+    int d = c / 1;
+    int e = d + 1;
+    int f = e - 1;
+    int g = f * 1;
+    return g % 10;
+}
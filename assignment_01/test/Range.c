@@ -0,0 +1,16 @@
+int rangeStrRed(int *a, int n) {
+    int s = 0;
+    // i is never negative: the signed division and remainder need no sign fixup
+    for (int i = 0; i < n; i++) {
+        s += a[i / 8] + a[i % 8] + a[i / 7];
+    }
+    return s;
+}
+
+int rangeFold(int b) {
+    int a = b & 255;
+    // always true, always a
+    int c = a < 256;
+    int d = a & 1023;
+    return c + d;
+}
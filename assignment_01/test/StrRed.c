@@ -11,4 +11,41 @@ int simpleStrRed2(int b) {
 int advStrRed(int b) {
     int a = b * 15;
     return a;
-}
\ No newline at end of file
+}
+
+int negDivStrRed(int b) {
+    int a = b / -8;
+    return a;
+}
+
+int magicDivStrRed(int b) {
+    int a = b / 7;
+    int c = b / 1000;
+    return a + c;
+}
+
+unsigned magicUDivStrRed(unsigned b) {
+    unsigned a = b / 10;
+    unsigned c = b / 7;
+    return a + c;
+}
+
+int mulChainStrRed(int b) {
+    int a = b * 10;
+    int c = b * 45;
+    int d = b * 0x1F1F;
+    return a + c + d;
+}
+
+unsigned remStrRed(unsigned b) {
+    unsigned a = b % 64;
+    unsigned c = b / 16u;
+    unsigned d = b % 1000;
+    return a + c + d;
+}
+
+int signedRemStrRed(int b) {
+    int a = b % 8;
+    int c = b % 10;
+    return a + c;
+}
@@ -0,0 +1,16 @@
+typedef int v8i __attribute__((vector_size(32)));
+typedef unsigned v8u __attribute__((vector_size(32)));
+
+v8i vecAlgIdStrRed(v8i b) {
+    v8i zero = {0, 0, 0, 0, 0, 0, 0, 0};
+    v8i eight = {8, 8, 8, 8, 8, 8, 8, 8};
+    v8i a = b + zero;
+    v8i c = a * eight;
+    return c / 7;
+}
+
+v8u vecPow2StrRed(v8u b) {
+    v8u pows = {1, 2, 4, 8, 16, 32, 64, 128};
+    v8u a = b * pows;
+    return a % pows;
+}
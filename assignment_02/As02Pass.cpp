@@ -0,0 +1,1177 @@
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/ScopedHashTable.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/raw_ostream.h"
+#include "DataFlow.h"
+#include "../assignment_01/RewriteRules.h"
+#include <memory>
+
+using namespace llvm;
+using namespace dataflow;
+
+/*
+*   Print the elements of Set as {e1, e2, ...}, each one printed by PrintElem
+*/
+void printSet(raw_ostream &OS, const BitVector &Set, function_ref<void(unsigned)> PrintElem){
+    OS << "{";
+    bool First = true;
+    for (unsigned Idx : Set.set_bits()) {
+        if (!First)
+            OS << ", ";
+        PrintElem(Idx);
+        First = false;
+    }
+    OS << "}";
+}
+
+/*
+*   Print the name of a basic block
+*/
+void printBlockName(raw_ostream &OS, const BasicBlock &B){
+    B.printAsOperand(OS, false);
+}
+
+/*
+*   Fold I with the constant operands Ops, nullptr if it can not be folded.
+*   Compares have their own entry point in the constant folder
+*/
+Constant *foldInstruction(Instruction &I, ArrayRef<Constant*> Ops, const DataLayout &DL){
+    if (CmpInst *Cmp = dyn_cast<CmpInst>(&I))
+        return ConstantFoldCompareInstOperands(Cmp->getPredicate(), Ops[0], Ops[1], DL);
+    return ConstantFoldInstOperands(&I, Ops, DL);
+}
+
+//-----------------------------------------------------------------------------
+// Very Busy Expressions
+//-----------------------------------------------------------------------------
+/*
+*   An expression is identified by the opcode and the operands of a binary operator:
+*   all the instructions computing a - b are the same expression
+*/
+typedef std::pair<unsigned, std::pair<Value*, Value*>> ExpressionKey;
+
+/*
+*   The expressions of a function, numbered in order of appearance
+*/
+struct ExpressionSet {
+    // the first instruction computing each expression
+    SmallVector<Instruction*, 32> Expressions;
+    DenseMap<ExpressionKey, unsigned> Index;
+
+    void collect(Function &F){
+        for (Instruction &I : instructions(F)) {
+            if (!isa<BinaryOperator>(I))
+                continue;
+            ExpressionKey Key = {I.getOpcode(), {I.getOperand(0), I.getOperand(1)}};
+            if (Index.insert({Key, Expressions.size()}).second)
+                Expressions.push_back(&I);
+        }
+    }
+
+    // number of the expression computed by I, -1 if I is not an expression
+    int lookup(const Instruction &I) const {
+        if (!isa<BinaryOperator>(I))
+            return -1;
+        auto It = Index.find({I.getOpcode(), {I.getOperand(0), I.getOperand(1)}});
+        return It == Index.end() ? -1 : It->second;
+    }
+
+    unsigned size() const { return Expressions.size(); }
+
+    void print(raw_ostream &OS, unsigned Idx) const {
+        Instruction *I = Expressions[Idx];
+        OS << I->getOpcodeName() << " ";
+        I->getOperand(0)->printAsOperand(OS, false);
+        OS << ", ";
+        I->getOperand(1)->printAsOperand(OS, false);
+    }
+};
+
+/*
+*   Gen[b] = the expressions evaluated in b before any definition of their operands,
+*   Kill[b] = the expressions with an operand defined in b
+*/
+template <typename Analysis>
+void setLocalExpressionSets(Function &F, const ExpressionSet &Expressions, Analysis &DFA){
+    for (Instruction &I : instructions(F)) {
+        int Idx = Expressions.lookup(I);
+        if (Idx == -1 || !DFA.isReachable(*I.getParent()))
+            continue;
+        bool DefinedInBlock = false;
+        for (Value *Op : I.operands()) {
+            Instruction *OpInst = dyn_cast<Instruction>(Op);
+            if (!OpInst)
+                continue;
+            // an operand defined in a block kills the expression above the definition
+            if (DFA.isReachable(*OpInst->getParent()))
+                DFA.getKill(*OpInst->getParent()).set(Idx);
+            DefinedInBlock |= OpInst->getParent() == I.getParent();
+        }
+        // evaluated in the block before any definition of its operands
+        if (!DefinedInBlock)
+            DFA.getGen(*I.getParent()).set(Idx);
+    }
+}
+
+/*
+*   Result of the very busy expressions analysis
+*   (backward, meet = intersection, in[exit] = empty set, interior points = all expressions)
+*/
+struct VeryBusyExpressionsInfo {
+    ExpressionSet Expressions;
+    std::unique_ptr<DataFlowAnalysis<Direction::Backward, Meet::Intersection>> DFA;
+    unsigned Visits;
+};
+
+class VeryBusyExpressions : public AnalysisInfoMixin<VeryBusyExpressions> {
+    friend AnalysisInfoMixin<VeryBusyExpressions>;
+    static AnalysisKey Key;
+
+public:
+    typedef VeryBusyExpressionsInfo Result;
+
+    Result run(Function &F, FunctionAnalysisManager &AM){
+        Result R;
+        R.Expressions.collect(F);
+        unsigned N = R.Expressions.size();
+        R.DFA = std::make_unique<DataFlowAnalysis<Direction::Backward, Meet::Intersection>>(F, N, BitVector(N), BitVector(N, true));
+        setLocalExpressionSets(F, R.Expressions, *R.DFA);
+        R.Visits = R.DFA->solve();
+        return R;
+    }
+};
+AnalysisKey VeryBusyExpressions::Key;
+
+//-----------------------------------------------------------------------------
+// Dominator Analysis
+//-----------------------------------------------------------------------------
+/*
+*   Result of the dominator analysis
+*   (forward, meet = intersection, out[entry] = {entry}, interior points = all blocks)
+*/
+struct DominatorSetsInfo {
+    // the basic blocks, numbered in function order
+    SmallVector<BasicBlock*, 32> Blocks;
+    std::unique_ptr<DataFlowAnalysis<Direction::Forward, Meet::Intersection>> DFA;
+    unsigned Visits;
+};
+
+class DominatorSets : public AnalysisInfoMixin<DominatorSets> {
+    friend AnalysisInfoMixin<DominatorSets>;
+    static AnalysisKey Key;
+
+public:
+    typedef DominatorSetsInfo Result;
+
+    Result run(Function &F, FunctionAnalysisManager &AM){
+        Result R;
+        for (BasicBlock &B : F)
+            R.Blocks.push_back(&B);
+        unsigned N = R.Blocks.size();
+        R.DFA = std::make_unique<DataFlowAnalysis<Direction::Forward, Meet::Intersection>>(F, N, BitVector(N), BitVector(N, true));
+        // Dom[b] = {b} U in[b]
+        for (unsigned Idx = 0; Idx < N; ++Idx) {
+            if (R.DFA->isReachable(*R.Blocks[Idx]))
+                R.DFA->getGen(*R.Blocks[Idx]).set(Idx);
+        }
+        R.Visits = R.DFA->solve();
+        return R;
+    }
+};
+AnalysisKey DominatorSets::Key;
+
+//-----------------------------------------------------------------------------
+// Constant Propagation
+//-----------------------------------------------------------------------------
+/*
+*   Values of the function and their constants: in SSA form each value has a single
+*   definition, so the constant of a pair (v, c) depends only on v, while the sets
+*   tell where v is known to be constant
+*/
+struct ConstantPropagationState {
+    const DataLayout *DL;
+    // the values which may be constant (instructions with a result), numbered in order of appearance
+    SmallVector<Instruction*, 32> Values;
+    DenseMap<const Value*, unsigned> Index;
+    // the constant of each value, as last computed by the transfer function
+    DenseMap<const Value*, Constant*> Constants;
+
+    /*
+    *   Return the constant of V if it is known in Set, nullptr otherwise
+    */
+    Constant *getConstant(Value *V, const BitVector &Set) const {
+        if (Constant *C = dyn_cast<Constant>(V))
+            return C;
+        auto It = Index.find(V);
+        if (It == Index.end() || !Set.test(It->second))
+            return nullptr;
+        return Constants.lookup(V);
+    }
+};
+
+/*
+*   Transfer function of constant propagation: Kill[b] are the values defined in b, Gen[b]
+*   the values whose operands are constants in the set, as it is updated by the instructions
+*   of b. It depends on in[b] (and on out[pred] for phis), so it is not a plain gen/kill
+*/
+struct ConstantPropagationTransfer {
+    ConstantPropagationState *State;
+
+    template <typename Analysis>
+    void operator()(const Analysis &A, const BasicBlock &B, const BitVector &Input, BitVector &Result) const {
+        Result = Input;
+        for (const Instruction &I : B) {
+            auto It = State->Index.find(&I);
+            if (It == State->Index.end())
+                continue;
+            Constant *C = nullptr;
+            if (const PHINode *Phi = dyn_cast<PHINode>(&I))
+                C = evaluatePhi(A, *Phi);
+            else
+                C = evaluate(const_cast<Instruction&>(I), Result);
+            if (C) {
+                Result.set(It->second);
+                State->Constants[&I] = C;
+            } else {
+                Result.reset(It->second);
+                State->Constants.erase(&I);
+            }
+        }
+    }
+
+    /*
+    *   Fold I if all its operands are constants in Set
+    */
+    Constant *evaluate(Instruction &I, const BitVector &Set) const {
+        if (I.mayReadOrWriteMemory() || I.isTerminator() || isa<CallBase>(I) || isa<AllocaInst>(I))
+            return nullptr;
+        SmallVector<Constant*, 4> Ops;
+        for (Value *Op : I.operands()) {
+            Constant *C = State->getConstant(Op, Set);
+            if (!C)
+                return nullptr;
+            Ops.push_back(C);
+        }
+        return foldInstruction(I, Ops, *State->DL);
+    }
+
+    /*
+    *   A phi is constant if the value coming from every predecessor is the same constant
+    *   (the meet of the out sets of the predecessors, value by value)
+    */
+    template <typename Analysis>
+    Constant *evaluatePhi(const Analysis &A, const PHINode &Phi) const {
+        Constant *Common = nullptr;
+        for (unsigned Idx = 0; Idx < Phi.getNumIncomingValues(); ++Idx) {
+            BasicBlock *Pred = Phi.getIncomingBlock(Idx);
+            Value *V = Phi.getIncomingValue(Idx);
+            if (!A.isReachable(*Pred))
+                continue;
+            Constant *C = State->getConstant(V, A.getOut(*Pred));
+            if (!C) {
+                // still unknown: the predecessor has not been visited yet
+                if (State->Index.count(V) && A.getOut(*Pred).test(State->Index.lookup(V)))
+                    continue;
+                return nullptr;
+            }
+            if (Common && Common != C)
+                return nullptr;
+            Common = C;
+        }
+        return Common;
+    }
+};
+
+/*
+*   Result of the constant propagation analysis
+*   (forward, meet = intersection, out[entry] = empty set, interior points = all pairs)
+*/
+struct ConstantPropagationInfo {
+    std::unique_ptr<ConstantPropagationState> State;
+    std::unique_ptr<DataFlowAnalysis<Direction::Forward, Meet::Intersection, ConstantPropagationTransfer>> DFA;
+    unsigned Visits;
+
+    void print(raw_ostream &OS, unsigned Idx) const {
+        Instruction *I = State->Values[Idx];
+        OS << "(";
+        I->printAsOperand(OS, false);
+        OS << ", ";
+        State->Constants.lookup(I)->printAsOperand(OS, false);
+        OS << ")";
+    }
+};
+
+class ConstantPropagation : public AnalysisInfoMixin<ConstantPropagation> {
+    friend AnalysisInfoMixin<ConstantPropagation>;
+    static AnalysisKey Key;
+
+public:
+    typedef ConstantPropagationInfo Result;
+
+    Result run(Function &F, FunctionAnalysisManager &AM){
+        Result R;
+        R.State = std::make_unique<ConstantPropagationState>();
+        R.State->DL = &F.getParent()->getDataLayout();
+        for (Instruction &I : instructions(F)) {
+            if (I.getType()->isVoidTy())
+                continue;
+            R.State->Index[&I] = R.State->Values.size();
+            R.State->Values.push_back(&I);
+        }
+        unsigned N = R.State->Values.size();
+        R.DFA = std::make_unique<DataFlowAnalysis<Direction::Forward, Meet::Intersection, ConstantPropagationTransfer>>(
+            F, N, BitVector(N), BitVector(N, true), ConstantPropagationTransfer{R.State.get()});
+        R.Visits = R.DFA->solve();
+        return R;
+    }
+};
+AnalysisKey ConstantPropagation::Key;
+
+//-----------------------------------------------------------------------------
+// Sparse Conditional Constant Propagation
+//-----------------------------------------------------------------------------
+/*
+*   Lattice value of an SSA value: Unknown (top, no evidence yet), Constant, or
+*   Overdefined (bottom, may have more than one value). A value only goes down
+*/
+struct LatticeValue {
+    enum { Unknown, Constant, Overdefined } State = Unknown;
+    llvm::Constant *C = nullptr;
+};
+
+/*
+*   Sparse conditional constant propagation (Wegman-Zadeck). Instructions are visited when
+*   their block becomes executable and again only when an operand goes down in the lattice,
+*   following the def-use edges; the edges of the CFG become executable only when a
+*   terminator can take them. Every value goes down at most twice and every edge is marked
+*   once, so the solver runs in time linear in the size of the IR.
+*/
+class SCCPSolver {
+public:
+    explicit SCCPSolver(const DataLayout &DL) : DL(DL) {}
+
+    /*
+    *   Solve the function: at the end an executable terminator whose condition is still
+    *   unknown (it depends on undef) is considered overdefined, and the solver goes on
+    */
+    void solve(Function &F){
+        markBlockExecutable(&F.getEntryBlock());
+        do {
+            propagate();
+        } while (resolveUnknownBranches(F));
+    }
+
+    bool isExecutable(const BasicBlock *B) const { return ExecutableBlocks.count(B); }
+    bool isEdgeExecutable(const BasicBlock *From, const BasicBlock *To) const { return ExecutableEdges.count({From, To}); }
+
+    /*
+    *   Return the lattice value of V: constants are constants, arguments are overdefined
+    */
+    LatticeValue getValue(Value *V) const {
+        LatticeValue LV;
+        if (Constant *C = dyn_cast<Constant>(V)) {
+            LV.State = LatticeValue::Constant;
+            LV.C = C;
+        } else if (isa<Instruction>(V)) {
+            LV = Values.lookup(V);
+        } else {
+            LV.State = LatticeValue::Overdefined;
+        }
+        return LV;
+    }
+
+private:
+    void propagate(){
+        while (!InstWorklist.empty() || !BlockWorklist.empty()) {
+            // the users of the values which went down in the lattice
+            while (!InstWorklist.empty()) {
+                Instruction *I = InstWorklist.pop_back_val();
+                for (User *U : I->users()) {
+                    Instruction *UserInst = cast<Instruction>(U);
+                    if (isExecutable(UserInst->getParent()))
+                        visit(*UserInst);
+                }
+            }
+            // the blocks which became executable
+            while (!BlockWorklist.empty()) {
+                BasicBlock *B = BlockWorklist.pop_back_val();
+                for (Instruction &I : *B)
+                    visit(I);
+            }
+        }
+    }
+
+    bool resolveUnknownBranches(Function &F){
+        bool Changed = false;
+        for (BasicBlock &B : F) {
+            if (!isExecutable(&B))
+                continue;
+            Instruction *Term = B.getTerminator();
+            if ((isa<BranchInst>(Term) || isa<SwitchInst>(Term)) && Values.lookup(Term).State == LatticeValue::Unknown
+                && Term->getNumSuccessors() > 0 && getValue(Term->getOperand(0)).State == LatticeValue::Unknown) {
+                markOverdefined(*Term);
+                for (BasicBlock *Succ : successors(&B))
+                    Changed |= markEdgeExecutable(&B, Succ);
+            }
+        }
+        return Changed;
+    }
+
+    void markBlockExecutable(BasicBlock *B){
+        if (ExecutableBlocks.insert(B).second)
+            BlockWorklist.push_back(B);
+    }
+
+    /*
+    *   Return true if the edge was not executable before
+    */
+    bool markEdgeExecutable(BasicBlock *From, BasicBlock *To){
+        if (!ExecutableEdges.insert({From, To}).second)
+            return false;
+        if (!isExecutable(To)) {
+            markBlockExecutable(To);
+        } else {
+            // a new incoming value for the phis
+            for (PHINode &Phi : To->phis())
+                visit(Phi);
+        }
+        return true;
+    }
+
+    void markConstant(Instruction &I, Constant *C){
+        LatticeValue &LV = Values[&I];
+        if (LV.State == LatticeValue::Overdefined || (LV.State == LatticeValue::Constant && LV.C == C))
+            return;
+        if (LV.State == LatticeValue::Constant) {
+            markOverdefined(I);
+            return;
+        }
+        LV.State = LatticeValue::Constant;
+        LV.C = C;
+        InstWorklist.push_back(&I);
+    }
+
+    void markOverdefined(Instruction &I){
+        LatticeValue &LV = Values[&I];
+        if (LV.State == LatticeValue::Overdefined)
+            return;
+        LV.State = LatticeValue::Overdefined;
+        LV.C = nullptr;
+        InstWorklist.push_back(&I);
+    }
+
+    void visit(Instruction &I){
+        if (Values.lookup(&I).State == LatticeValue::Overdefined && !I.isTerminator())
+            return;
+        if (PHINode *Phi = dyn_cast<PHINode>(&I))
+            visitPhi(*Phi);
+        else if (I.isTerminator())
+            visitTerminator(I);
+        else
+            visitInstruction(I);
+    }
+
+    /*
+    *   Meet of the incoming values along the executable edges
+    */
+    void visitPhi(PHINode &Phi){
+        Constant *Common = nullptr;
+        for (unsigned Idx = 0; Idx < Phi.getNumIncomingValues(); ++Idx) {
+            if (!isEdgeExecutable(Phi.getIncomingBlock(Idx), Phi.getParent()))
+                continue;
+            LatticeValue LV = getValue(Phi.getIncomingValue(Idx));
+            if (LV.State == LatticeValue::Unknown)
+                continue;
+            if (LV.State == LatticeValue::Overdefined || (Common && Common != LV.C)) {
+                markOverdefined(Phi);
+                return;
+            }
+            Common = LV.C;
+        }
+        if (Common)
+            markConstant(Phi, Common);
+    }
+
+    /*
+    *   Mark the successors the terminator can branch to
+    */
+    void visitTerminator(Instruction &Term){
+        BasicBlock *B = Term.getParent();
+        if (BranchInst *Br = dyn_cast<BranchInst>(&Term)) {
+            if (Br->isUnconditional()) {
+                markEdgeExecutable(B, Br->getSuccessor(0));
+                return;
+            }
+            LatticeValue Cond = getValue(Br->getCondition());
+            if (Cond.State == LatticeValue::Unknown)
+                return;
+            ConstantInt *CI = dyn_cast_or_null<ConstantInt>(Cond.C);
+            if (Cond.State == LatticeValue::Constant && CI) {
+                markEdgeExecutable(B, Br->getSuccessor(CI->isZero() ? 1 : 0));
+                return;
+            }
+        }
+        else if (SwitchInst *SI = dyn_cast<SwitchInst>(&Term)) {
+            LatticeValue Cond = getValue(SI->getCondition());
+            if (Cond.State == LatticeValue::Unknown)
+                return;
+            ConstantInt *CI = dyn_cast_or_null<ConstantInt>(Cond.C);
+            if (Cond.State == LatticeValue::Constant && CI) {
+                markEdgeExecutable(B, SI->findCaseValue(CI)->getCaseSuccessor());
+                return;
+            }
+        }
+        // any other terminator, or a condition which is not a constant integer
+        for (BasicBlock *Succ : successors(B))
+            markEdgeExecutable(B, Succ);
+    }
+
+    /*
+    *   Fold the instruction if all its operands are constants
+    */
+    void visitInstruction(Instruction &I){
+        if (I.getType()->isVoidTy() || I.mayReadOrWriteMemory() || isa<CallBase>(I) || isa<AllocaInst>(I)
+            || I.isEHPad()) {
+            markOverdefined(I);
+            return;
+        }
+        SmallVector<Constant*, 4> Ops;
+        for (Value *Op : I.operands()) {
+            LatticeValue LV = getValue(Op);
+            // wait for the operand to be known
+            if (LV.State == LatticeValue::Unknown)
+                return;
+            if (LV.State == LatticeValue::Overdefined) {
+                markOverdefined(I);
+                return;
+            }
+            Ops.push_back(LV.C);
+        }
+        if (Constant *C = foldInstruction(I, Ops, DL))
+            markConstant(I, C);
+        else
+            markOverdefined(I);
+    }
+
+    const DataLayout &DL;
+    DenseMap<Value*, LatticeValue> Values;
+    SmallPtrSet<const BasicBlock*, 32> ExecutableBlocks;
+    DenseSet<std::pair<const BasicBlock*, const BasicBlock*>> ExecutableEdges;
+    SmallVector<Instruction*, 64> InstWorklist;
+    SmallVector<BasicBlock*, 32> BlockWorklist;
+};
+
+/*
+*   Replace the values proven constant, turn the branches with a constant condition into
+*   unconditional ones and delete the blocks which are never executed
+*/
+bool applySCCP(Function &F, SCCPSolver &Solver){
+    bool Changed = false;
+    SmallVector<BasicBlock*, 8> DeadBlocks;
+    for (BasicBlock &B : F) {
+        if (!Solver.isExecutable(&B)) {
+            DeadBlocks.push_back(&B);
+            continue;
+        }
+        for (Instruction &I : make_early_inc_range(B)) {
+            LatticeValue LV = Solver.getValue(&I);
+            if (I.isTerminator() || LV.State != LatticeValue::Constant)
+                continue;
+            I.replaceAllUsesWith(LV.C);
+            if (!I.mayHaveSideEffects())
+                I.eraseFromParent();
+            Changed = true;
+        }
+        // a single executable successor: the terminator becomes an unconditional branch
+        Instruction *Term = B.getTerminator();
+        if (!isa<BranchInst>(Term) && !isa<SwitchInst>(Term))
+            continue;
+        BasicBlock *Target = nullptr;
+        unsigned NumTargets = 0;
+        for (BasicBlock *Succ : successors(&B)) {
+            if (Solver.isEdgeExecutable(&B, Succ) && Succ != Target) {
+                Target = Succ;
+                ++NumTargets;
+            }
+        }
+        if (NumTargets != 1 || (isa<BranchInst>(Term) && cast<BranchInst>(Term)->isUnconditional()))
+            continue;
+        // one PHI entry for each removed edge, as ConstantFoldTerminator does
+        for (BasicBlock *Succ : successors(&B)) {
+            if (Succ != Target)
+                Succ->removePredecessor(&B);
+        }
+        // the target keeps a single incoming edge from B
+        unsigned Edges = 0;
+        for (BasicBlock *Succ : successors(&B))
+            Edges += Succ == Target;
+        for (; Edges > 1; --Edges)
+            Target->removePredecessor(&B, /*KeepOneInputPHIs*/ true);
+        BranchInst::Create(Target, Term);
+        Term->eraseFromParent();
+        Changed = true;
+    }
+    if (!DeadBlocks.empty()) {
+        DeleteDeadBlocks(DeadBlocks);
+        Changed = true;
+    }
+    return Changed;
+}
+
+//-----------------------------------------------------------------------------
+// Lazy Code Motion
+//-----------------------------------------------------------------------------
+typedef DataFlowAnalysis<Direction::Backward, Meet::Intersection> AnticipatedExpressions;
+typedef DataFlowAnalysis<Direction::Forward, Meet::Intersection> AvailableExpressions;
+typedef DataFlowAnalysis<Direction::Forward, Meet::Intersection> PostponableExpressions;
+typedef DataFlowAnalysis<Direction::Backward, Meet::Union> UsedExpressions;
+
+/*
+*   Split the critical edges, so that an expression can be placed on any edge of the CFG
+*   by placing it at the beginning of a block. Return the new blocks
+*/
+SmallVector<BasicBlock*, 8> splitCriticalEdges(Function &F){
+    SmallVector<BasicBlock*, 8> NewBlocks;
+    SmallVector<BasicBlock*, 32> Blocks;
+    for (BasicBlock &B : F)
+        Blocks.push_back(&B);
+    for (BasicBlock *B : Blocks) {
+        Instruction *Term = B->getTerminator();
+        for (unsigned Idx = 0; Idx < Term->getNumSuccessors(); ++Idx) {
+            if (!isCriticalEdge(Term, Idx))
+                continue;
+            if (BasicBlock *NewBlock = SplitCriticalEdge(Term, Idx))
+                NewBlocks.push_back(NewBlock);
+        }
+    }
+    return NewBlocks;
+}
+
+/*
+*   Replace the repeated evaluations of an expression inside a block with the first one:
+*   in SSA form the operands can not change in between
+*/
+bool eliminateLocalRedundancies(Function &F){
+    bool Changed = false;
+    for (BasicBlock &B : F) {
+        DenseMap<ExpressionKey, Instruction*> First;
+        for (Instruction &I : make_early_inc_range(B)) {
+            if (!isa<BinaryOperator>(I))
+                continue;
+            auto It = First.insert({{I.getOpcode(), {I.getOperand(0), I.getOperand(1)}}, &I}).first;
+            if (It->second == &I)
+                continue;
+            // the flags must hold for both evaluations
+            It->second->andIRFlags(&I);
+            I.replaceAllUsesWith(It->second);
+            I.eraseFromParent();
+            Changed = true;
+        }
+    }
+    return Changed;
+}
+
+/*
+*   Lazy code motion (Knoop, Ruthing, Steffen), on the blocks of a function with no
+*   critical edges and no local redundancies:
+*   - anticipated (very busy) expressions, backward: in[b] = Use[b] U (out[b] - Kill[b])
+*   - available expressions, forward: out[b] = Eval[b] U ((anticipated.in[b] U in[b]) - Kill[b])
+*   - earliest[b] = anticipated.in[b] - available.in[b]
+*   - postponable expressions, forward: out[b] = (earliest[b] U in[b]) - Use[b]
+*   - latest[b] = (earliest[b] U postponable.in[b]) n
+*                 (Use[b] U not(n_{s in succ(b)} (earliest[s] U postponable.in[s])))
+*   - used expressions, backward, meet = union: in[b] = (Use[b] U out[b]) - latest[b]
+*   where Use[b] are the expressions evaluated in b before any definition of their operands
+*   and Eval[b] all the expressions evaluated in b.
+*   An expression is placed in b if it is in latest[b] and in used.out[b] but not in Use[b]
+*   (b does not evaluate it, so it goes right before the terminator), and its evaluations
+*   in Use[b] are replaced unless b is a latest point. The temporary holding the value is
+*   rebuilt in SSA form by SSAUpdater
+*/
+class LazyCodeMotion {
+public:
+    explicit LazyCodeMotion(Function &F) : F(F) {}
+
+    bool run(){
+        SmallVector<BasicBlock*, 8> SplitBlocks = splitCriticalEdges(F);
+        bool Changed = eliminateLocalRedundancies(F);
+        Expressions.collect(F);
+        N = Expressions.size();
+        if (N > 0) {
+            solve();
+            for (unsigned Idx = 0; Idx < N; ++Idx)
+                Changed |= moveExpression(Idx);
+        }
+        // the edges which received no computation are joined again, the blocks left in the
+        // CFG change the function
+        for (BasicBlock *B : SplitBlocks) {
+            if (&B->front() != B->getTerminator() || !TryToSimplifyUncondBranchFromEmptyBlock(B))
+                Changed = true;
+        }
+        return Changed;
+    }
+
+private:
+    void solve(){
+        BitVector Empty(N), All(N, true);
+        Anticipated = std::make_unique<AnticipatedExpressions>(F, N, Empty, All);
+        setLocalExpressionSets(F, Expressions, *Anticipated);
+        // a path which never reaches the exit evaluates nothing: without this, the greatest
+        // fixed point would anticipate every expression in an infinite loop
+        df_iterator_default_set<BasicBlock*, 32> ReachesExit;
+        for (BasicBlock *B : Anticipated->blocks()) {
+            if (succ_empty(B)) {
+                for (BasicBlock *Pred : inverse_depth_first_ext(B, ReachesExit))
+                    (void)Pred;
+            }
+        }
+        for (BasicBlock *B : Anticipated->blocks()) {
+            if (!ReachesExit.count(B)) {
+                Anticipated->getGen(*B).reset();
+                Anticipated->getKill(*B).set();
+            }
+        }
+        Anticipated->solve();
+
+        // the evaluations of every expression, one per block
+        Evaluations.resize(N);
+        for (BasicBlock *B : Anticipated->blocks()) {
+            for (Instruction &I : *B) {
+                int Idx = Expressions.lookup(I);
+                if (Idx != -1)
+                    Evaluations[Idx].push_back(&I);
+            }
+        }
+
+        Available = std::make_unique<AvailableExpressions>(F, N, Empty, All);
+        for (BasicBlock *B : Available->blocks()) {
+            BitVector &Gen = Available->getGen(*B);
+            Gen = Anticipated->getIn(*B);
+            Gen.reset(Anticipated->getKill(*B));
+            Available->getKill(*B) = Anticipated->getKill(*B);
+        }
+        for (unsigned Idx = 0; Idx < N; ++Idx) {
+            for (Instruction *I : Evaluations[Idx])
+                Available->getGen(*I->getParent()).set(Idx);
+        }
+        Available->solve();
+
+        for (BasicBlock *B : Anticipated->blocks()) {
+            BitVector &E = Earliest[B];
+            E = Anticipated->getIn(*B);
+            E.reset(Available->getIn(*B));
+        }
+
+        Postponable = std::make_unique<PostponableExpressions>(F, N, Empty, All);
+        for (BasicBlock *B : Postponable->blocks()) {
+            const BitVector &Use = Anticipated->getGen(*B);
+            Postponable->getGen(*B) = Earliest[B];
+            Postponable->getGen(*B).reset(Use);
+            Postponable->getKill(*B) = Use;
+        }
+        Postponable->solve();
+
+        for (BasicBlock *B : Anticipated->blocks()) {
+            // the expressions which can not be postponed into every successor
+            BitVector Successors(N, true);
+            for (BasicBlock *Succ : successors(B)) {
+                BitVector Candidates = Earliest[Succ];
+                Candidates |= Postponable->getIn(*Succ);
+                Successors &= Candidates;
+            }
+            Successors.flip();
+            Successors |= Anticipated->getGen(*B);
+            BitVector &L = Latest[B];
+            L = Earliest[B];
+            L |= Postponable->getIn(*B);
+            L &= Successors;
+        }
+
+        Used = std::make_unique<UsedExpressions>(F, N, Empty, Empty);
+        for (BasicBlock *B : Used->blocks()) {
+            Used->getGen(*B) = Anticipated->getGen(*B);
+            Used->getGen(*B).reset(Latest[B]);
+            Used->getKill(*B) = Latest[B];
+        }
+        Used->solve();
+    }
+
+    /*
+    *   Place the expression Idx at its latest points and replace its redundant evaluations,
+    *   return true if the function changed
+    */
+    bool moveExpression(unsigned Idx){
+        SmallVector<Instruction*, 4> Redundant;
+        for (Instruction *I : Evaluations[Idx]) {
+            BasicBlock *B = I->getParent();
+            if (Anticipated->getGen(*B).test(Idx) && !Latest[B].test(Idx))
+                Redundant.push_back(I);
+        }
+        // hoisting an expression which may trap is not safe
+        if (Redundant.empty() || !isSafeToSpeculativelyExecute(Expressions.Expressions[Idx]))
+            return false;
+
+        // the flags must hold for every evaluation the new temporary replaces
+        Instruction *Prototype = Expressions.Expressions[Idx]->clone();
+        for (Instruction *I : Evaluations[Idx])
+            Prototype->andIRFlags(I);
+
+        SSAUpdater Temporary;
+        Temporary.Initialize(Prototype->getType(), Expressions.Expressions[Idx]->getName());
+        for (Instruction *I : Evaluations[Idx]) {
+            if (!llvm::is_contained(Redundant, I)) {
+                I->andIRFlags(Prototype);
+                Temporary.AddAvailableValue(I->getParent(), I);
+            }
+        }
+        for (BasicBlock *B : Anticipated->blocks()) {
+            if (!Latest[B].test(Idx) || !Used->getOut(*B).test(Idx) || Anticipated->getGen(*B).test(Idx))
+                continue;
+            Instruction *New = Prototype->clone();
+            New->insertBefore(B->getTerminator());
+            New->setName(Expressions.Expressions[Idx]->getName());
+            Temporary.AddAvailableValue(B, New);
+        }
+        Prototype->deleteValue();
+
+        for (Instruction *I : Redundant) {
+            I->replaceAllUsesWith(Temporary.GetValueInMiddleOfBlock(I->getParent()));
+            I->eraseFromParent();
+        }
+        return true;
+    }
+
+    Function &F;
+    ExpressionSet Expressions;
+    unsigned N = 0;
+    // the evaluations of each expression, at most one per block
+    SmallVector<SmallVector<Instruction*, 4>, 32> Evaluations;
+    std::unique_ptr<AnticipatedExpressions> Anticipated;
+    std::unique_ptr<AvailableExpressions> Available;
+    std::unique_ptr<PostponableExpressions> Postponable;
+    std::unique_ptr<UsedExpressions> Used;
+    DenseMap<const BasicBlock*, BitVector> Earliest, Latest;
+};
+
+//-----------------------------------------------------------------------------
+// Global Value Numbering
+//-----------------------------------------------------------------------------
+/*
+*   An expression in terms of the value numbers of its operands: two instructions with
+*   the same expression compute the same value. Unused operands are numbered 0
+*/
+struct NumberedExpression {
+    unsigned Opcode;
+    Type *Ty;
+    unsigned Predicate;
+    unsigned Ops[3];
+};
+
+namespace llvm {
+template <> struct DenseMapInfo<NumberedExpression> {
+    static NumberedExpression getEmptyKey() { return {~0U, nullptr, 0, {0, 0, 0}}; }
+    static NumberedExpression getTombstoneKey() { return {~0U - 1, nullptr, 0, {0, 0, 0}}; }
+    static unsigned getHashValue(const NumberedExpression &E) {
+        return hash_combine(E.Opcode, E.Ty, E.Predicate, E.Ops[0], E.Ops[1], E.Ops[2]);
+    }
+    static bool isEqual(const NumberedExpression &L, const NumberedExpression &R) {
+        return L.Opcode == R.Opcode && L.Ty == R.Ty && L.Predicate == R.Predicate && L.Ops[0] == R.Ops[0]
+            && L.Ops[1] == R.Ops[1] && L.Ops[2] == R.Ops[2];
+    }
+};
+} // namespace llvm
+
+/*
+*   Dominator-tree scoped value numbering: the blocks are visited in preorder on the
+*   dominator tree (with an explicit stack, as EarlyCSE does), and the expressions computed in a block are visible only to the blocks
+*   it dominates (the scope of the hash table is popped when the visit leaves the subtree).
+*   An instruction whose expression is already in the table is replaced by the dominating
+*   leader, and its operands are leaders, so equal numbers mean equal operand values.
+*   - operands of commutative operations and of compares are ordered by number, so
+*     a + b and b + a, a < b and b > a have the same expression
+*   - the algebraic identities of As01 (a + 0, a * 1, a - a, ...) are applied first, so
+*     a + 0 is replaced by a and gets its number
+*/
+class GlobalValueNumbering {
+public:
+    GlobalValueNumbering(DominatorTree &DT) : DT(DT) {}
+
+    bool run(){
+        Changed = false;
+        // the path from the root is kept on an explicit stack, as a recursion would overflow
+        // the call stack on deep dominator trees
+        SmallVector<std::unique_ptr<StackFrame>, 16> Stack;
+        Stack.push_back(std::make_unique<StackFrame>(DT.getRootNode(), Leaders));
+        processBlock(*DT.getRootNode()->getBlock());
+        while (!Stack.empty()) {
+            StackFrame &Top = *Stack.back();
+            if (Top.NextChild == Top.Node->end()) {
+                // the visit leaves the subtree: its expressions go out of scope
+                Stack.pop_back();
+                continue;
+            }
+            DomTreeNode *Child = *Top.NextChild++;
+            Stack.push_back(std::make_unique<StackFrame>(Child, Leaders));
+            processBlock(*Child->getBlock());
+        }
+        return Changed;
+    }
+
+private:
+    typedef ScopedHashTable<NumberedExpression, Instruction*> LeaderTable;
+
+    /*
+    *   A node of the dominator tree on the visited path: the next child to visit and the
+    *   scope of the expressions computed in the block
+    */
+    struct StackFrame {
+        StackFrame(DomTreeNode *Node, LeaderTable &Leaders)
+            : Node(Node), NextChild(Node->begin()), Scope(Leaders) {}
+        DomTreeNode *Node;
+        DomTreeNode::iterator NextChild;
+        ScopedHashTableScope<NumberedExpression, Instruction*> Scope;
+    };
+
+    void processBlock(BasicBlock &B){
+        for (Instruction &I : make_early_inc_range(B)) {
+            if (Value *V = rewrite::AlgebraicIdentityRules::simplify(I)) {
+                I.replaceAllUsesWith(V);
+                I.eraseFromParent();
+                Changed = true;
+                continue;
+            }
+            NumberedExpression E;
+            if (!getExpression(I, E))
+                continue;
+            if (Instruction *Leader = Leaders.lookup(E)) {
+                // the flags must hold for both instructions
+                Leader->andIRFlags(&I);
+                I.replaceAllUsesWith(Leader);
+                I.eraseFromParent();
+                Changed = true;
+                continue;
+            }
+            Leaders.insert(E, &I);
+        }
+    }
+
+    /*
+    *   Number of a value, a new one the first time it is seen
+    */
+    unsigned getNumber(Value *V){
+        auto It = Numbers.insert({V, Numbers.size() + 1}).first;
+        return It->second;
+    }
+
+    /*
+    *   Build the expression of I, return false if I is not numbered (memory accesses,
+    *   calls, phis and the other instructions whose value does not depend only on the operands)
+    */
+    bool getExpression(Instruction &I, NumberedExpression &E){
+        if (!isa<BinaryOperator>(I) && !isa<CmpInst>(I) && !isa<CastInst>(I) && !isa<SelectInst>(I)
+            && !isa<UnaryOperator>(I))
+            return false;
+        E.Opcode = I.getOpcode();
+        E.Ty = I.getType();
+        E.Predicate = 0;
+        E.Ops[0] = E.Ops[1] = E.Ops[2] = 0;
+        for (unsigned Idx = 0; Idx < I.getNumOperands(); ++Idx)
+            E.Ops[Idx] = getNumber(I.getOperand(Idx));
+        if (CmpInst *Cmp = dyn_cast<CmpInst>(&I)) {
+            CmpInst::Predicate Pred = Cmp->getPredicate();
+            if (E.Ops[0] > E.Ops[1]) {
+                std::swap(E.Ops[0], E.Ops[1]);
+                Pred = CmpInst::getSwappedPredicate(Pred);
+            }
+            E.Predicate = Pred;
+        } else if (I.isCommutative() && E.Ops[0] > E.Ops[1]) {
+            std::swap(E.Ops[0], E.Ops[1]);
+        }
+        return true;
+    }
+
+    DominatorTree &DT;
+    LeaderTable Leaders;
+    DenseMap<Value*, unsigned> Numbers;
+    bool Changed = false;
+};
+
+//-----------------------------------------------------------------------------
+// Printers
+//-----------------------------------------------------------------------------
+namespace {
+    struct VeryBusyExpressionsPrinter: PassInfoMixin<VeryBusyExpressionsPrinter> {
+        raw_ostream &OS;
+        explicit VeryBusyExpressionsPrinter(raw_ostream &OS) : OS(OS) {}
+
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM) {
+            VeryBusyExpressionsInfo &R = AM.getResult<VeryBusyExpressions>(F);
+            OS << "Very Busy Expressions of " << F.getName() << " (" << R.Visits << " block visits)\n";
+            for (BasicBlock &B : F) {
+                if (!R.DFA->isReachable(B))
+                    continue;
+                auto PrintExpr = [&](unsigned Idx) { R.Expressions.print(OS, Idx); };
+                printBlockName(OS, B);
+                OS << "\n  IN:  ";
+                printSet(OS, R.DFA->getIn(B), PrintExpr);
+                OS << "\n  OUT: ";
+                printSet(OS, R.DFA->getOut(B), PrintExpr);
+                OS << "\n";
+            }
+            return PreservedAnalyses::all();
+        }
+        static bool isRequired() { return true; }
+    };
+
+    struct DominatorSetsPrinter: PassInfoMixin<DominatorSetsPrinter> {
+        raw_ostream &OS;
+        explicit DominatorSetsPrinter(raw_ostream &OS) : OS(OS) {}
+
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM) {
+            DominatorSetsInfo &R = AM.getResult<DominatorSets>(F);
+            OS << "Dominators of " << F.getName() << " (" << R.Visits << " block visits)\n";
+            for (BasicBlock &B : F) {
+                if (!R.DFA->isReachable(B))
+                    continue;
+                OS << "Dom[";
+                printBlockName(OS, B);
+                OS << "] = ";
+                printSet(OS, R.DFA->getOut(B), [&](unsigned Idx) { printBlockName(OS, *R.Blocks[Idx]); });
+                OS << "\n";
+            }
+            return PreservedAnalyses::all();
+        }
+        static bool isRequired() { return true; }
+    };
+
+    struct ConstantPropagationPrinter: PassInfoMixin<ConstantPropagationPrinter> {
+        raw_ostream &OS;
+        explicit ConstantPropagationPrinter(raw_ostream &OS) : OS(OS) {}
+
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM) {
+            ConstantPropagationInfo &R = AM.getResult<ConstantPropagation>(F);
+            OS << "Constant Propagation of " << F.getName() << " (" << R.Visits << " block visits)\n";
+            for (BasicBlock &B : F) {
+                if (!R.DFA->isReachable(B))
+                    continue;
+                auto PrintPair = [&](unsigned Idx) { R.print(OS, Idx); };
+                printBlockName(OS, B);
+                OS << "\n  IN:  ";
+                printSet(OS, R.DFA->getIn(B), PrintPair);
+                OS << "\n  OUT: ";
+                printSet(OS, R.DFA->getOut(B), PrintPair);
+                OS << "\n";
+            }
+            return PreservedAnalyses::all();
+        }
+        static bool isRequired() { return true; }
+    };
+
+    // Sparse Conditional Constant Propagation
+    struct SCCPPass: PassInfoMixin<SCCPPass> {
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM) {
+            SCCPSolver Solver(F.getParent()->getDataLayout());
+            Solver.solve(F);
+            if (!applySCCP(F, Solver))
+                return PreservedAnalyses::all();
+            return PreservedAnalyses::none();
+        }
+        static bool isRequired() { return true; }
+    };
+
+    // Lazy Code Motion
+    struct LazyCodeMotionPass: PassInfoMixin<LazyCodeMotionPass> {
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM) {
+            if (!LazyCodeMotion(F).run())
+                return PreservedAnalyses::all();
+            return PreservedAnalyses::none();
+        }
+        static bool isRequired() { return true; }
+    };
+
+    // Global Value Numbering
+    struct GVNPass: PassInfoMixin<GVNPass> {
+        PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM) {
+            DominatorTree &DT = AM.getResult<DominatorTreeAnalysis>(F);
+            if (!GlobalValueNumbering(DT).run())
+                return PreservedAnalyses::all();
+            PreservedAnalyses PA;
+            PA.preserveSet<CFGAnalyses>();
+            return PA;
+        }
+        static bool isRequired() { return true; }
+    };
+} // namespace
+
+//-----------------------------------------------------------------------------
+// New PM Registration
+//-----------------------------------------------------------------------------
+llvm::PassPluginLibraryInfo getTestPassPluginInfo() {
+  return {LLVM_PLUGIN_API_VERSION, "as-02-pass", LLVM_VERSION_STRING,
+          [](PassBuilder &PB) {
+            // the analyses, available through the analysis manager
+            PB.registerAnalysisRegistrationCallback(
+                [](FunctionAnalysisManager &FAM) {
+                    FAM.registerPass([] { return VeryBusyExpressions(); });
+                    FAM.registerPass([] { return DominatorSets(); });
+                    FAM.registerPass([] { return ConstantPropagation(); });
+                });
+            PB.registerPipelineParsingCallback(
+                [](StringRef Name, FunctionPassManager &FPM,
+                ArrayRef<PassBuilder::PipelineElement>) {
+                    // Very Busy Expressions
+                    if ( Name == "print<vbe>" ){
+                        FPM.addPass(VeryBusyExpressionsPrinter(outs()));
+                        return true;
+                    }
+                    // Dominator Analysis
+                    if ( Name == "print<dom-sets>" ){
+                        FPM.addPass(DominatorSetsPrinter(outs()));
+                        return true;
+                    }
+                    // Constant Propagation
+                    if ( Name == "print<const-prop>" ){
+                        FPM.addPass(ConstantPropagationPrinter(outs()));
+                        return true;
+                    }
+                    // Sparse Conditional Constant Propagation
+                    if ( Name == "sccp-pass" ){
+                        FPM.addPass(SCCPPass());
+                        return true;
+                    }
+                    // Lazy Code Motion
+                    if ( Name == "lcm-pass" ){
+                        FPM.addPass(LazyCodeMotionPass());
+                        return true;
+                    }
+                    // Global Value Numbering
+                    if ( Name == "gvn-pass" ){
+                        FPM.addPass(GVNPass());
+                        return true;
+                    }
+                    return false;
+                });
+          }};
+}
+
+// This is the core interface for pass plugins. It guarantees that 'opt' will
+// be able to recognize TestPass when added to the pass pipeline on the
+// command line, i.e. via '-passes=test-pass'
+extern "C" LLVM_ATTRIBUTE_WEAK ::llvm::PassPluginLibraryInfo
+llvmGetPassPluginInfo() {
+  return getTestPassPluginInfo();
+}
@@ -0,0 +1,186 @@
+#ifndef AS02_DATAFLOW_H
+#define AS02_DATAFLOW_H
+
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Function.h"
+#include <algorithm>
+
+/*
+*   Generic iterative data flow framework on dense bit vectors.
+*   A problem is described by
+*   - its direction: Forward (in[b] = meet(out[pred]), out[b] = f(in[b])) or
+*     Backward (out[b] = meet(in[succ]), in[b] = f(out[b]))
+*   - its meet operator: Union or Intersection
+*   - its transfer function: by default f(x) = Gen[b] U (x - Kill[b]), a functor can replace
+*     it when the transfer depends on more than the gen and kill sets (see GenKillTransfer)
+*   - the size of the domain, the boundary condition and the initial value of interior points
+*
+*   The worklist always takes the pending block which comes first in reverse post-order
+*   (post-order for backward problems), so an acyclic CFG is solved in a single pass and
+*   loops are iterated only as long as their sets change. Only the blocks reachable from the
+*   entry block are analyzed.
+*/
+namespace dataflow {
+
+using namespace llvm;
+
+enum class Direction { Forward, Backward };
+enum class Meet { Union, Intersection };
+
+/*
+*   The sets of a basic block
+*/
+struct BlockSets {
+    BitVector In, Out, Gen, Kill;
+};
+
+/*
+*   Default transfer function: Result = Gen U (Input - Kill)
+*/
+struct GenKillTransfer {
+    template <typename Analysis>
+    void operator()(const Analysis &A, const BasicBlock &B, const BitVector &Input, BitVector &Result) const {
+        Result = Input;
+        Result.reset(A.getKill(B));
+        Result |= A.getGen(B);
+    }
+};
+
+template <Direction Dir, Meet MeetOp, typename Transfer = GenKillTransfer>
+class DataFlowAnalysis {
+public:
+    DataFlowAnalysis(Function &F, unsigned DomainSize, const BitVector &Boundary, const BitVector &Init,
+                     Transfer T = Transfer())
+        : DomainSize(DomainSize), Boundary(Boundary), T(T) {
+        assert(Boundary.size() == DomainSize && Init.size() == DomainSize && "sets out of the domain");
+        // reverse post-order for forward problems, post-order for backward ones
+        for (BasicBlock *B : post_order(&F.getEntryBlock())) {
+            Order.push_back(B);
+        }
+        if (Dir == Direction::Forward) {
+            std::reverse(Order.begin(), Order.end());
+        }
+        Sets.resize(Order.size());
+        for (unsigned Idx = 0; Idx < Order.size(); ++Idx) {
+            Index[Order[Idx]] = Idx;
+            Sets[Idx].In = Init;
+            Sets[Idx].Out = Init;
+            Sets[Idx].Gen = BitVector(DomainSize);
+            Sets[Idx].Kill = BitVector(DomainSize);
+        }
+    }
+
+    unsigned getDomainSize() const { return DomainSize; }
+    // The analyzed blocks, in the order they are first visited
+    ArrayRef<BasicBlock*> blocks() const { return Order; }
+    bool isReachable(const BasicBlock &B) const { return Index.count(&B); }
+
+    BitVector &getGen(const BasicBlock &B) { return getSets(B).Gen; }
+    BitVector &getKill(const BasicBlock &B) { return getSets(B).Kill; }
+    const BitVector &getGen(const BasicBlock &B) const { return getSets(B).Gen; }
+    const BitVector &getKill(const BasicBlock &B) const { return getSets(B).Kill; }
+    const BitVector &getIn(const BasicBlock &B) const { return getSets(B).In; }
+    const BitVector &getOut(const BasicBlock &B) const { return getSets(B).Out; }
+    Transfer &getTransfer() { return T; }
+
+    /*
+    *   Iterate up to the fixed point, return the number of transfer function evaluations
+    */
+    unsigned solve() {
+        unsigned Visits = 0;
+        // blocks whose input may have changed, by position in Order
+        BitVector Pending(Order.size(), true);
+        BitVector Input(DomainSize), Result(DomainSize);
+        for (int Idx = Pending.find_first(); Idx != -1; Idx = Pending.find_first()) {
+            Pending.reset(Idx);
+            BasicBlock *B = Order[Idx];
+            meetInputs(*B, Input);
+            T(*this, *B, Input, Result);
+            ++Visits;
+            BlockSets &S = Sets[Idx];
+            (Dir == Direction::Forward ? S.In : S.Out) = Input;
+            BitVector &Output = Dir == Direction::Forward ? S.Out : S.In;
+            if (Result == Output) {
+                continue;
+            }
+            Output = Result;
+            // the blocks reading this output are visited again
+            if (Dir == Direction::Forward) {
+                for (BasicBlock *Succ : successors(B)) {
+                    Pending.set(Index.lookup(Succ));
+                }
+            } else {
+                for (BasicBlock *Pred : predecessors(B)) {
+                    auto It = Index.find(Pred);
+                    if (It != Index.end()) {
+                        Pending.set(It->second);
+                    }
+                }
+            }
+        }
+        return Visits;
+    }
+
+private:
+    BlockSets &getSets(const BasicBlock &B) {
+        assert(Index.count(&B) && "block not reachable from the entry");
+        return Sets[Index.lookup(&B)];
+    }
+    const BlockSets &getSets(const BasicBlock &B) const {
+        assert(Index.count(&B) && "block not reachable from the entry");
+        return Sets[Index.lookup(&B)];
+    }
+
+    /*
+    *   Input = meet of the outputs of the neighbours, or the boundary condition
+    *   for the entry block (forward) and the exit blocks (backward)
+    */
+    void meetInputs(BasicBlock &B, BitVector &Input) const {
+        bool First = true;
+        auto MeetWith = [&](const BitVector &V) {
+            if (First) {
+                Input = V;
+                First = false;
+            } else if (MeetOp == Meet::Union) {
+                Input |= V;
+            } else {
+                Input &= V;
+            }
+        };
+        if (Dir == Direction::Forward) {
+            if (&B == &B.getParent()->getEntryBlock()) {
+                Input = Boundary;
+                return;
+            }
+            for (BasicBlock *Pred : predecessors(&B)) {
+                // unreachable predecessors do not contribute
+                auto It = Index.find(Pred);
+                if (It != Index.end()) {
+                    MeetWith(Sets[It->second].Out);
+                }
+            }
+        } else {
+            for (BasicBlock *Succ : successors(&B)) {
+                MeetWith(Sets[Index.lookup(Succ)].In);
+            }
+            if (First) {
+                Input = Boundary;
+            }
+        }
+    }
+
+    unsigned DomainSize;
+    BitVector Boundary;
+    Transfer T;
+    SmallVector<BasicBlock*, 32> Order;
+    DenseMap<const BasicBlock*, unsigned> Index;
+    SmallVector<BlockSets, 32> Sets;
+};
+
+} // namespace dataflow
+
+#endif // AS02_DATAFLOW_H
@@ -0,0 +1,19 @@
+int constProp(int c, int n) {
+    int k = 2;
+    int a, x, y, b;
+    if (c) {
+        a = k + 2;
+        x = 5;
+    } else {
+        a = k * 2;
+        x = 8;
+    }
+    k = a;
+    while (k < n) {
+        b = 2;
+        x = a + k;
+        y = a * b;
+        k++;
+    }
+    return a + x;
+}
@@ -0,0 +1,13 @@
+int dominators(int a, int b, int c) {
+    int r = 0;
+    if (a > 0) {
+        r = b;
+    } else {
+        if (b > 0)
+            r = a;
+        else
+            r = c;
+        r = r * 2;
+    }
+    return r;
+}
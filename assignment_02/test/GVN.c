@@ -0,0 +1,16 @@
+int gvn(int a, int b, int c) {
+    int x = 3 * a;
+    int r;
+    if (c) {
+        // same numbers as x and a + b: the operands are ordered
+        int y = a * 3;
+        int z = b + a;
+        r = y + z;
+    } else {
+        // a + 0 gets the number of a
+        int w = (a + 0) * 3;
+        r = w - x;
+    }
+    // dominated by x
+    return r + 3 * a;
+}
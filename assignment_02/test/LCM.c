@@ -0,0 +1,13 @@
+int lcm(int a, int b, int c, int n) {
+    int x = 0, y, s = 0;
+    // a + b is partially redundant: only the path through the if computes it
+    if (c > 0)
+        x = a + b;
+    y = a + b;
+    // a * b is anticipated at the loop entry and is computed once
+    do {
+        s = s + a * b;
+        n--;
+    } while (n > 0);
+    return x + y + s;
+}
@@ -0,0 +1,19 @@
+int sccp(int n) {
+    int x = 1;
+    int i = 0;
+    while (i < n) {
+        if (x == 1)
+            x = x * 1;
+        else
+            x = x + 1;
+        i++;
+    }
+    switch (x) {
+    case 1:
+        return x * 10;
+    case 2:
+        return n;
+    default:
+        return -1;
+    }
+}
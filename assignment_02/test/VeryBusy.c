@@ -0,0 +1,12 @@
+int veryBusy(int a, int b) {
+    int x, y;
+    if (a != b) {
+        x = b - a;
+        x = a - b;
+    } else {
+        y = b - a;
+        a = 0;
+        x = a - b;
+    }
+    return x;
+}
@@ -19,10 +19,27 @@
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/LoopIterator.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/MemorySSA.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/LoopUtils.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Dominators.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include <iostream>
 #include <vector>
 
@@ -50,86 +67,151 @@ using namespace std;
 #endif
 
 /*
-* LOOP INVARIANCE FUNCTIONS
+* set of loop-invariant instructions: membership in constant time, iteration in insertion order
 */
+typedef SetVector<Instruction*> InstrSet;
 
-bool isLoopInvInstr(Instruction &I, vector<Instruction*> &loopInvInstr, Loop &L);
+/*
+* LOOP INVARIANCE ANALYSIS
+*/
 
 /*
-* function that checks wether an operand from a BinaryOp is considered loop-invariant
+* function that checks wether a call computes a pure function of its operands: a known function
+* which does not access memory, always returns and does not throw (e.g. sqrt, abs)
 */
-bool isLoopInvOp(Value *OP, vector<Instruction*> &loopInvInstr, Loop &L) {
+bool isPureCall(CallInst &CI) {
+  return CI.getCalledFunction() && CI.doesNotAccessMemory() && !CI.mayHaveSideEffects()
+         && !CI.isConvergent();
+}
 
-  // check if the operand is a constant or a function argument
-  if ( isa<ConstantInt>(OP) ) {
-    D2("\t\tOperand is constant -> labeling as linv");
-    return true;
-  }else if ( isa<Argument>(OP) ){
-    D2("\t\tOperand is a function argument -> labeling as linv")
-    return true;
-  }
+/*
+* function that checks wether an instruction is subject to the loop invariance check: the value of
+* these instructions depends only on their operands (and on memory, for the loads), whatever their
+* number
+*/
+bool isInvarianceCandidate(Instruction &I) {
+  if ( LoadInst *LI = dyn_cast<LoadInst>(&I) )
+    return LI->isSimple();
+  if ( CallInst *CI = dyn_cast<CallInst>(&I) )
+    return isPureCall(*CI);
+  return I.isBinaryOp() || I.isUnaryOp() || isa<GetElementPtrInst>(I) || isa<CastInst>(I)
+         || isa<CmpInst>(I) || isa<SelectInst>(I) || isa<FreezeInst>(I);
+}
 
-  // Cast from Value to Instruction to perform checks
-  if ( dyn_cast<Instruction>(OP) ) {
-    Instruction *OpInst = dyn_cast<Instruction>(OP);
+/*
+* result of the loop invariance analysis.
+* Invariance is monotone along the loop nest: an instruction invariant in a loop is invariant in all
+* the loops nested in it (and containing it). So, for each instruction, only the outermost loop in
+* which it is invariant is stored, and this answers every query, "not invariant" included: the
+* instruction is variant in the loops enclosing that one, and in all its loops if there is none.
+* The loops are visited once, in preorder on the nest: an instruction already known to be invariant
+* in an enclosing loop is not checked again, and the blocks of a loop are visited in reverse
+* post-order, so the operands are always classified before their users (PHI nodes aside, which are
+* never invariant) and no recursion is needed.
+* A load is invariant if its address is, and MemorySSA finds the access clobbering it outside the loop
+*/
+class LoopInvarianceInfo {
+public:
+  LoopInvarianceInfo(LoopInfo &LI, MemorySSA &MSSA) {
+    for (Loop *TL : LI) {
+      for (Loop *L : TL->getLoopsInPreorder())
+        computeLoop(*L, LI, MSSA);
+    }
+  }
 
-    // Check if the operand is already in the loop invariant instructions vector
-    if ( find(loopInvInstr.begin(), loopInvInstr.end(), OpInst) != loopInvInstr.end() ) {
-      D2("\t\tOperand already labeled as loop-invariant");
+  /*
+  * function that checks wether a value is loop-invariant in 'L'
+  */
+  bool isInvariant(Value *V, const Loop &L) const {
+    // check if the operand is a constant (globals included, as load addresses) or a function argument
+    if ( isa<Constant>(V) || isa<Argument>(V) )
       return true;
-    // check if the operand is outside the loop 
-    } else if (!L.contains(OpInst)) {
-      D2("\t\tOperand defined outside the loop -> labeling as linv");
-      return true;
-    // check if the operand is not a binary operation
-    } else if (!OpInst->isBinaryOp()) { // If inside loop, not already linv, not constant, and not BinaryOp, then is not linv
-      D2("\t\tOperand defined inside the loop and not a BinaryOp -> not linv");
+    Instruction *I = dyn_cast<Instruction>(V);
+    if ( !I )
       return false;
-    // check if the operand is loop invariant
-    } else if (isLoopInvInstr(*OpInst, loopInvInstr, L)) { // Cannot determine wether the operand is linv or not: recursive call to isLoopInvInstr(OPERATOR)
+    // check if the operand is outside the loop
+    if ( !L.contains(I) )
       return true;
+    Loop *outer = outermost.lookup(I);
+    return outer && outer->contains(&L);
+  }
+
+  /*
+  * outermost loop in which 'I' is invariant, nullptr if it is variant in all its loops
+  */
+  Loop *getOutermostInvariantLoop(Instruction *I) const {
+    return outermost.lookup(I);
+  }
+
+  /*
+  * the analysis is valid until the instructions change, or the loops do
+  */
+  bool invalidate(Function &F, const PreservedAnalyses &PA, FunctionAnalysisManager::Invalidator &Inv);
+
+private:
+  /*
+  * function that checks if no write to memory inside 'L' may change the value read by 'load'
+  */
+  bool isNotClobberedInLoop(LoadInst &load, Loop &L, MemorySSA &MSSA) {
+    MemoryAccess *clobber = MSSA.getWalker()->getClobberingMemoryAccess(&load);
+    return MSSA.isLiveOnEntryDef(clobber) || !L.contains(clobber->getBlock());
+  }
+
+  void computeLoop(Loop &L, LoopInfo &LI, MemorySSA &MSSA) {
+    D2("Computing loop invariance for the loop with header " << L.getHeader()->getName())
+    LoopBlocksRPO RPO(&L);
+    RPO.perform(&LI);
+    for (BasicBlock *B : RPO) {
+      for (Instruction &I : *B) {
+        // already invariant in an enclosing loop
+        if ( !isInvarianceCandidate(I) || outermost.count(&I) )
+          continue;
+        if ( isa<LoadInst>(I) && !isNotClobberedInLoop(cast<LoadInst>(I), L, MSSA) )
+          continue;
+        if ( all_of(I.operands(), [&](Value *OP) { return isInvariant(OP, L); }) ) {
+          D2("\t" << I << " is loop-invariant")
+          outermost[&I] = &L;
+        }
+      }
     }
   }
 
-  D2("OPERAND DID NOT PASS ANY TEST");
-  return false;
-}
+  DenseMap<const Instruction*, Loop*> outermost;
+};
 
 /*
-* function that checks wether a BinaryOp from a loop is considered loop-invariant
+* loop invariance analysis, so that the passes can query it through the analysis manager
 */
-bool isLoopInvInstr(Instruction &I, vector<Instruction*> &loopInvInstr, Loop &L) {
-  // Retrieve operands
-  Value *op1 = I.getOperand(0);
-  Value *op2 = I.getOperand(1);
+class LoopInvariance : public AnalysisInfoMixin<LoopInvariance> {
+  friend AnalysisInfoMixin<LoopInvariance>;
+  static AnalysisKey Key;
 
-  D2("\tBINARY OP:");
-  D2("\tOperand 1: " << *op1 );
-  D2("\tOperand 2: " << *op2 );
+public:
+  typedef LoopInvarianceInfo Result;
 
-  // Check if both are loop-invariant; if so, the instruction itself can be considered loop-invariant
-  if (isLoopInvOp(op1, loopInvInstr, L) && isLoopInvOp(op2, loopInvInstr, L)) {
-    D2("\tBoth operands are linv -> label as linv")
-    return true;
+  Result run(Function &F, FunctionAnalysisManager &AM) {
+    return LoopInvarianceInfo(AM.getResult<LoopAnalysis>(F), AM.getResult<MemorySSAAnalysis>(F).getMSSA());
   }
+};
+AnalysisKey LoopInvariance::Key;
 
-  return false;
+bool LoopInvarianceInfo::invalidate(Function &F, const PreservedAnalyses &PA, FunctionAnalysisManager::Invalidator &Inv) {
+  auto PAC = PA.getChecker<LoopInvariance>();
+  return !(PAC.preserved() || PAC.preservedSet<AllAnalysesOn<Function>>()) || Inv.invalidate<LoopAnalysis>(F, PA);
 }
 
 /*
 * function to retrieve loop-invariant instructions from a specific loop
 */
-void getLoopInvInstructions(vector<Instruction*> &loopInvInstr, Loop &L) {
+void getLoopInvInstructions(InstrSet &loopInvInstr, Loop &L, LoopInvarianceInfo &LInv) {
   // iteration over loop instructions (via its BBs first)
   for (Loop::block_iterator BI = L.block_begin(); BI != L.block_end(); ++BI) {
     BasicBlock *B = *BI;
     // iteration over BB instructions
     for (auto &I: *B) {
-      D2(I);
-      // Check for loop invariance applies only to BinaryOp instructions
-      if (I.isBinaryOp() && isLoopInvInstr(I, loopInvInstr, L)) {
-        D2("\tIS LOOP INVARIANT OP");
-        loopInvInstr.push_back(&I);
+      if (isInvarianceCandidate(I) && LInv.isInvariant(&I, L)) {
+        D2("\tIS LOOP INVARIANT OP: " << I);
+        loopInvInstr.insert(&I);
       }
     }
   }
@@ -141,96 +223,147 @@ void getLoopInvInstructions(vector<Instruction*> &loopInvInstr, Loop &L) {
 */
 
 /*
-* function that checks if the instruction 'I' has any use in PHI nodes internal to the loop,
-* which means there are multiple definitions of the same variable
+* live-out information of a loop, computed once per loop instead of walking the uses of every candidate.
+* For each value defined in the loop it holds the exit blocks where the value is live, either directly
+* or through the PHI nodes of the loop it flows into (the same variable before SSA), and whether the
+* variable has other definitions inside the loop
 */
-bool hasMultipleDef(Instruction *I, Loop &L){
-  D2("\tChecking if definition has multiple definitions")
-
-  // iteration over all the uses of the instruction
-  for (auto useIt = I->use_begin(); useIt != I->use_end(); ++useIt) {
-    User *use = useIt->getUser();
-    D3("\tChecking " << *I << "'s use " << *use)
+class LoopLiveOut {
+public:
+  LoopLiveOut(Loop &L, SmallVector<BasicBlock*> &exitBBs) {
+    for (unsigned i = 0; i < exitBBs.size(); i++)
+      exitIdx[exitBBs[i]] = i;
 
-    // check if the use is a PHI node to do more checks
-    if (isa<PHINode>(use)) {
-      PHINode *usePHI = dyn_cast<PHINode>(use);
-    
-      // check if PHI is inside the loop
-      if ( L.contains(usePHI) ){
-        D2( "\tFound a PHI node inside the loop, checking its arguments... (" << *usePHI << " )" )
+    // number the values defined in the loop
+    for (BasicBlock *B : L.blocks()) {
+      for (Instruction &I : *B) {
+        if (I.getType()->isVoidTy())
+          continue;
+        valueIdx[&I] = liveExits.size();
+        liveExits.push_back(BitVector(exitBBs.size()));
+        multipleDef.push_back(false);
+      }
+    }
 
-        // iteration over PHI incoming BBs, and check if there's at least another one from inside the loop apart from 'I'
-        for (int i = 0; i < usePHI->getNumIncomingValues(); i++) {
-          BasicBlock *incomingBB = usePHI->getIncomingBlock(i);
-        
-          D2("\tCurrent incoming BB: " << *incomingBB)
-          if ( L.contains(incomingBB) && I != dyn_cast<Instruction>(usePHI->getIncomingValue(i))) {
-            D2("\tThe variable has another definition from inside the loop!")
-            return true;
-          }
+    // SSA liveness: from each use outside the loop, walk the CFG backwards up to the definition,
+    // the exit blocks met on the way are the ones where the value is live. Once inside the loop
+    // the walk stays there and stops at the header, so it covers only the region between the
+    // exits and the definition
+    for (auto &entry : valueIdx) {
+      Instruction *I = entry.first;
+      SmallPtrSet<BasicBlock*, 16> visited;
+      SmallVector<BasicBlock*, 16> worklist;
+      for (Use &U : I->uses()) {
+        Instruction *useInst = cast<Instruction>(U.getUser());
+        if (L.contains(useInst))
+          continue;
+        // a PHI node uses the value at the end of the incoming block, and makes it live on
+        // the exit block holding it
+        if (PHINode *usePHI = dyn_cast<PHINode>(useInst)) {
+          auto exitIt = exitIdx.find(usePHI->getParent());
+          if (exitIt != exitIdx.end())
+            liveExits[entry.second].set(exitIt->second);
+          worklist.push_back(usePHI->getIncomingBlock(U));
+        } else {
+          worklist.push_back(useInst->getParent());
+        }
+      }
+      while (!worklist.empty()) {
+        BasicBlock *B = worklist.pop_back_val();
+        if (!visited.insert(B).second)
+          continue;
+        auto exitIt = exitIdx.find(B);
+        if (exitIt != exitIdx.end())
+          liveExits[entry.second].set(exitIt->second);
+        if (B == I->getParent() || B == L.getHeader())
+          continue;
+        bool inLoop = L.contains(B);
+        for (BasicBlock *pred : predecessors(B)) {
+          if (!inLoop || L.contains(pred))
+            worklist.push_back(pred);
+        }
+      }
+    }
 
-          #ifdef DEBUG
-          else {
-            D2("\tThe incoming use is the same, or defined outside the loop")
+    // a value is live wherever the PHI nodes of the loop using it are live, and the other
+    // incoming values of such a PHI node are other definitions of the same variable
+    SmallVector<PHINode*, 16> worklist;
+    for (BasicBlock *B : L.blocks()) {
+      for (PHINode &P : B->phis()) {
+        worklist.push_back(&P);
+        for (unsigned i = 0; i < P.getNumIncomingValues(); i++) {
+          Instruction *incoming = dyn_cast<Instruction>(P.getIncomingValue(i));
+          auto it = incoming ? valueIdx.find(incoming) : valueIdx.end();
+          if (it == valueIdx.end() || multipleDef[it->second])
+            continue;
+          for (unsigned j = 0; j < P.getNumIncomingValues(); j++) {
+            if (L.contains(P.getIncomingBlock(j)) && P.getIncomingValue(j) != incoming) {
+              multipleDef[it->second] = true;
+              break;
+            }
           }
-          #endif
-          
         }
       }
-    } else {
-      D3("\tSkipping use because not a PHI node")
+    }
+    while (!worklist.empty()) {
+      PHINode *P = worklist.pop_back_val();
+      const BitVector &phiExits = liveExits[valueIdx.lookup(P)];
+      for (Value *incoming : P->incoming_values()) {
+        auto it = valueIdx.find(dyn_cast<Instruction>(incoming));
+        if (it == valueIdx.end())
+          continue;
+        BitVector &incomingExits = liveExits[it->second];
+        // propagate again only if something changed
+        BitVector old = incomingExits;
+        incomingExits |= phiExits;
+        if (incomingExits != old && isa<PHINode>(it->first))
+          worklist.push_back(cast<PHINode>(it->first));
+      }
     }
   }
-  D2("\t\tOK")
-  return false;
-}
 
-/*
-* function checks if variable is dead outside the loop 
-*/
-bool isDeadOutsideLoop(Instruction *I, Loop &L) {
-  D2("\t\tChecking if definition is alive outside loop")
+  /*
+  * function that checks if the variable defined by 'I' is live on the exit block 'exitBB'
+  */
+  bool isLiveOnExit(Instruction *I, BasicBlock *exitBB) {
+    return liveExits[valueIdx.lookup(I)].test(exitIdx.lookup(exitBB));
+  }
 
-  BasicBlock *useBB;
-  
-  // iteration over all the uses of the instruction
-  for (auto useIt = I->use_begin(); useIt != I->use_end(); ++useIt) {
-    User *use = useIt->getUser();
-    
-    // check if the use is an instruction
-    if (isa<Instruction>(use)) {
-      Instruction *useInst = dyn_cast<Instruction>(use);
-      // check if the use is outside the loop
-      if ( !L.contains(useInst) ){
-        D2("\tThe use " << *useInst << " of " << *I << " is outside the loop -> NOT DEAD");
-        return false;
-      }
-      // if the use is a PHINode from inside, check for its uses outside the loop as well
-      else if (isa<PHINode>(useInst)) {
-        return isDeadOutsideLoop(useInst,L);
-      }
-    }
+  /*
+  * function that checks if the variable defined by 'I' is dead on all the exit blocks
+  */
+  bool isDeadOutsideLoop(Instruction *I) {
+    return liveExits[valueIdx.lookup(I)].none();
+  }
+
+  /*
+  * function that checks if the instruction 'I' has any use in PHI nodes internal to the loop
+  * with another incoming definition from inside the loop
+  */
+  bool hasMultipleDef(Instruction *I) {
+    return multipleDef[valueIdx.lookup(I)];
   }
-  D2( "\t\tOK" )
-  return true;
-}
+
+private:
+  DenseMap<Instruction*, unsigned> valueIdx;
+  DenseMap<BasicBlock*, unsigned> exitIdx;
+  vector<BitVector> liveExits;
+  vector<bool> multipleDef;
+};
 
 /*
 * function to check wether a code motion candidate instruction dominates all exit BBs or, if it doesn't, if it's dead outside the loop
 */
-bool domsAllLivePaths(Instruction *I, Loop &L, DominatorTree &DT, SmallVector<BasicBlock*> &exitBBs) {
+bool domsAllLivePaths(Instruction *I, DominatorTree &DT, SmallVector<BasicBlock*> &exitBBs, LoopLiveOut &liveOut) {
   D2("\tChecking if definition dominates all paths where is not dead")
   // get the BB of the loop invariant instruction
   BasicBlock *BBInst = I->getParent();
 
-  // check if the BB dominates all the loop exits
+  // check if the BB dominates all the loop exits where the variable is live
   for (auto &exitBlock : exitBBs) {
-    if ( !DT.dominates(BBInst, exitBlock) ) {
-      D2("The instruction does not dominate all loop exits, specifically:\n\t" << *exitBlock << "\n")
-      
-      // additional check on variable liveness outside the loop
-      return isDeadOutsideLoop(I,L);
+    if ( !DT.dominates(BBInst, exitBlock) && liveOut.isLiveOnExit(I, exitBlock) ) {
+      D2("The instruction does not dominate the loop exit, where its variable is live:\n\t" << *exitBlock << "\n")
+      return false;
     }
   }
 
@@ -238,10 +371,62 @@ bool domsAllLivePaths(Instruction *I, Loop &L, DominatorTree &DT, SmallVector<Ba
   return true;
 }
 
+/*
+* function that checks if the whole body of the loop runs once the loop is entered: no instruction
+* may throw or never return, so the blocks dominating all the exits run at least once
+*/
+bool alwaysTransfersExecution(Loop &L) {
+  for (BasicBlock *B : L.blocks()) {
+    for (Instruction &I : *B) {
+      if ( !isGuaranteedToTransferExecutionToSuccessor(&I) )
+        return false;
+    }
+  }
+  return true;
+}
+
+/*
+* function that checks if an instruction can be executed in the preheader: either it can not trap
+* (a division by zero, an invalid load), or it is guaranteed to run at least once whenever the loop
+* is entered
+*/
+bool isSafeToHoist(Instruction *I, Loop &L, DominatorTree &DT, SmallVector<BasicBlock*> &exitBBs) {
+  if ( isSafeToSpeculativelyExecute(I) )
+    return true;
+  for (BasicBlock *exitBlock : exitBBs) {
+    if ( !DT.dominates(I->getParent(), exitBlock) )
+      return false;
+  }
+  return alwaysTransfersExecution(L);
+}
+
+/*
+* speculation budget of a loop: total cost of the instructions which can be hoisted even if they
+* run only on some iterations (0 disables speculation)
+*/
+static cl::opt<unsigned> speculationBudget("licm-speculation-budget", cl::init(4),
+    cl::desc("Cost of the instructions licm-pass may hoist speculatively from each loop"));
+
+/*
+* function that checks if an invariant instruction which does not dominate the exits where it is
+* live can be hoisted anyway: it must be safe to execute on every path, and cheap enough to fit
+* in the speculation budget left for the loop
+*/
+bool canSpeculate(Instruction *I, TargetTransformInfo &TTI, InstructionCost &spent) {
+  if ( !isSafeToSpeculativelyExecute(I) )
+    return false;
+  InstructionCost cost = TTI.getInstructionCost(I, TargetTransformInfo::TCK_SizeAndLatency);
+  if ( !cost.isValid() || spent + cost > speculationBudget )
+    return false;
+  spent += cost;
+  D2("\t\tSpeculated with cost " << cost << ", " << spent << " of the budget used")
+  return true;
+}
+
 /*
 * function that finds the code motion candidates
 */
-void findCodeMotionCandidates(vector<Instruction*> &loopInvInstr, DominatorTree &DT, Loop &L){
+void findCodeMotionCandidates(InstrSet &loopInvInstr, DominatorTree &DT, TargetTransformInfo &TTI, Loop &L){
   SmallVector<BasicBlock*> exitBBs; 
   L.getExitBlocks(exitBBs);
   
@@ -259,25 +444,285 @@ void findCodeMotionCandidates(vector<Instruction*> &loopInvInstr, DominatorTree
   D2("------")
   #endif
 
-  // iteration over the loop invariant instructions
-  for (auto it = loopInvInstr.begin(); it != loopInvInstr.end();) {
-    // get instruction from the iterator
-    Instruction *I = *it;
+  // live-out sets of the loop, shared by all the candidates
+  LoopLiveOut liveOut(L, exitBBs);
+  // cost of the instructions hoisted speculatively
+  InstructionCost spent = 0;
+
+  // filter the loop invariant instructions, keeping their order
+  loopInvInstr.remove_if([&](Instruction *I) {
     D2("Checking if " << *I << " is a candidate")
-    
-    // check if the instruction has multiple definitions inside the loop
-    if( hasMultipleDef(I, L) ) {
-      D1("Erasing " << *I << " from loopInvInstr because has multiple definitions inside the loop ");
-      loopInvInstr.erase(it);
-    // check if the instruction dominates all exit blocks  where is alive
-    } else if ( !domsAllLivePaths(I, L, DT, exitBBs) ) { 
-      D1("Erasing " << *I << " from loopInvInstr because it doesn't dominate all loop exit blocks where is alive ");
-      loopInvInstr.erase(it);
-    } else { // increase the iterator only if element not deleted
-      D2("\t" << *I << " is a valid candidate for code motion")
-      ++it;
+
+    // check if the instruction has multiple definitions inside the loop, or if it doesn't dominate
+    // all exit blocks where is alive: it can then be hoisted only speculatively, running on every
+    // path (the PHI nodes merging it with the other definitions still select the same values)
+    bool multipleDef = liveOut.hasMultipleDef(I);
+    if ( multipleDef || !domsAllLivePaths(I, DT, exitBBs, liveOut) ) {
+      if ( !canSpeculate(I, TTI, spent) ) {
+        D1("Erasing " << *I << " from loopInvInstr because " << (multipleDef ? "has multiple definitions inside the loop "
+           : "it doesn't dominate all loop exit blocks where is alive "));
+        return true;
+      }
+      D1(*I << " will be hoisted speculatively")
+    }
+    // check if the instruction might trap on paths where the loop did not execute it
+    if ( !isSafeToHoist(I, L, DT, exitBBs) ) {
+      D1("Erasing " << *I << " from loopInvInstr because it might trap and might not be executed by the loop ");
+      return true;
+    }
+    D2("\t" << *I << " is a valid candidate for code motion")
+    return false;
+  });
+}
+
+/*
+* SCALAR PROMOTION FUNCTIONS
+*/
+
+/*
+* rewrites the loads and stores of a promoted location with the value kept in a register, and stores
+* the final value of the location in the exit blocks
+*/
+class LoopPromoter : public LoadAndStorePromoter {
+public:
+  LoopPromoter(ArrayRef<const Instruction*> insts, SSAUpdater &SSA, Value *ptr, Align align,
+               SmallVector<BasicBlock*> &exitBBs)
+    : LoadAndStorePromoter(insts, SSA), updater(SSA), ptr(ptr), align(align), exitBBs(exitBBs) {}
+
+  void doExtraRewritesBeforeFinalDeletion() override {
+    for (BasicBlock *exitBlock : exitBBs) {
+      Value *liveOut = updater.GetValueInMiddleOfBlock(exitBlock);
+      StoreInst *store = new StoreInst(liveOut, ptr, false, align, &*exitBlock->getFirstInsertionPt());
+      D1("Stored the promoted value at the loop exit: " << *store)
+    }
+  }
+
+private:
+  SSAUpdater &updater;
+  Value *ptr;
+  Align align;
+  SmallVector<BasicBlock*> &exitBBs;
+};
+
+/*
+* function that promotes to a register the memory locations which are accessed in the loop only by
+* loads and stores to the same invariant address: the location is loaded once in the preheader and
+* stored once in each exit block. A location can be promoted if
+* 1. no other instruction of the loop may read or write it (alias analysis)
+* 2. a store to it runs whenever the loop is entered, so the stores at the exits write memory that
+*    the loop would have written anyway
+* Returns true if any location was promoted
+*/
+bool promoteLoopLocations(Loop &L, AAResults &AA, DominatorTree &DT) {
+  BasicBlock *phBB = L.getLoopPreheader();
+  SmallVector<BasicBlock*> exitBBs;
+  L.getExitBlocks(exitBBs);
+  // the stores go in exit blocks reached only from the loop
+  if ( !phBB || exitBBs.empty() || !L.hasDedicatedExits() || !alwaysTransfersExecution(L) )
+    return false;
+  const DataLayout &DL = phBB->getModule()->getDataLayout();
+
+  // the invariant addresses accessed by simple loads and stores
+  SetVector<Value*> pointers;
+  for (BasicBlock *B : L.blocks()) {
+    for (Instruction &I : *B) {
+      Value *ptr = getLoadStorePointerOperand(&I);
+      if ( ptr && (!isa<Instruction>(ptr) || !L.contains(cast<Instruction>(ptr))) )
+        pointers.insert(ptr);
+    }
+  }
+
+  bool promoted = false;
+  for (Value *ptr : pointers) {
+    SmallVector<Instruction*> accesses;
+    Type *accessTy = nullptr;
+    Align align;
+    bool guaranteedStore = false;
+    bool canPromote = true;
+
+    // first the accesses to the location, then the instructions which might alias them
+    for (BasicBlock *B : L.blocks()) {
+      for (Instruction &I : *B) {
+        if ( getLoadStorePointerOperand(&I) != ptr )
+          continue;
+        LoadInst *load = dyn_cast<LoadInst>(&I);
+        StoreInst *store = dyn_cast<StoreInst>(&I);
+        Type *ty = load ? load->getType() : store->getValueOperand()->getType();
+        if ( !(load ? load->isSimple() : store->isSimple()) || (accessTy && ty != accessTy)
+             || (store && store->getValueOperand() == ptr) ) {
+          canPromote = false;
+          break;
+        }
+        accessTy = ty;
+        Align accessAlign = load ? load->getAlign() : store->getAlign();
+        align = accesses.empty() ? accessAlign : std::min(align, accessAlign);
+        accesses.push_back(&I);
+        if ( store && all_of(exitBBs, [&](BasicBlock *E) { return DT.dominates(B, E); }) )
+          guaranteedStore = true;
+      }
+    }
+    if ( !canPromote || !guaranteedStore )
+      continue;
+    MemoryLocation loc(ptr, LocationSize::precise(DL.getTypeStoreSize(accessTy)));
+    for (BasicBlock *B : L.blocks()) {
+      for (Instruction &I : *B) {
+        if ( !I.mayReadOrWriteMemory() || getLoadStorePointerOperand(&I) == ptr )
+          continue;
+        if ( !isNoModRef(AA.getModRefInfo(&I, loc)) ) {
+          D2("Cannot promote " << *ptr << ": it may be accessed by " << I)
+          canPromote = false;
+          break;
+        }
+      }
+      if ( !canPromote )
+        break;
+    }
+    if ( !canPromote )
+      continue;
+
+    D1("Promoting to a register the location " << *ptr << " in the loop with header " << L.getHeader()->getName())
+    SmallVector<PHINode*, 8> newPHIs;
+    SSAUpdater SSA(&newPHIs);
+    LoopPromoter promoter(accesses, SSA, ptr, align, exitBBs);
+    LoadInst *preheaderLoad = new LoadInst(accessTy, ptr, ptr->getName() + ".promoted", false, align, phBB->getTerminator());
+    SSA.AddAvailableValue(phBB, preheaderLoad);
+    promoter.run(accesses);
+    promoted = true;
+  }
+  return promoted;
+}
+
+/*
+* COST MODEL FUNCTIONS
+*/
+
+/*
+* trip count assumed for the loops whose trip count is not a known constant
+*/
+const unsigned unknownTripCount = 8;
+
+/*
+* function that estimates the number of executions of 'I' saved by hoisting it: the product of the
+* trip counts of the loops it leaves, up to the outermost one in which it is invariant (see
+* getHoistTarget), times its cost
+*/
+InstructionCost estimateSavings(Instruction *I, Loop &L, TargetTransformInfo &TTI,
+                                DenseMap<Loop*, unsigned> &tripCounts, LoopInvarianceInfo &LInv) {
+  uint64_t executions = tripCounts.lookup(&L);
+  Loop *outermost = LInv.getOutermostInvariantLoop(I);
+  if ( outermost && isSafeToSpeculativelyExecute(I) ) {
+    for (Loop *P = L.getParentLoop(); P && outermost->contains(P); P = P->getParentLoop())
+      executions = std::min<uint64_t>(executions * tripCounts.lookup(P), 1 << 20);
+  }
+  return TTI.getInstructionCost(I, TargetTransformInfo::TCK_SizeAndLatency) * executions;
+}
+
+/*
+* function that selects the candidates to hoist without exceeding the registers of the target: every
+* value hoisted out of the loop and still used inside it occupies a register across the whole loop,
+* and once the register file is full the spills and reloads cost more than a cheap instruction
+* recomputed in the loop.
+* The pressure at the header is estimated from the values live across the loop (those defined before
+* it and used inside, and the loop-carried PHI nodes) against TTI::getNumberOfRegisters, for each
+* register class. The candidates are taken by decreasing savings, each one together with the candidate
+* operands it needs; a cheap group (no more than a basic instruction) is left in the loop if it needs
+* a register which is no longer free, the expensive ones are always hoisted
+*/
+void selectByRegisterPressure(InstrSet &loopInvInstr, Loop &L, TargetTransformInfo &TTI,
+                              DenseMap<Loop*, unsigned> &tripCounts, LoopInvarianceInfo &LInv) {
+  // free registers of each class, negative when the loop already spills
+  DenseMap<unsigned, int> freeRegs;
+  auto regClass = [&](Value *V) {
+    unsigned cls = TTI.getRegisterClassForType(V->getType()->isVectorTy(), V->getType());
+    freeRegs.try_emplace(cls, TTI.getNumberOfRegisters(cls));
+    return cls;
+  };
+
+  SmallPtrSet<Instruction*, 16> hoisted;
+  // a value is live across the loop while an instruction of the loop which is not hoisted uses it
+  auto isLiveAcross = [&](Value *V) {
+    return any_of(V->users(), [&](User *U) {
+      Instruction *userInst = dyn_cast<Instruction>(U);
+      return userInst && L.contains(userInst) && !hoisted.count(userInst);
+    });
+  };
+
+  SmallPtrSet<Value*, 32> liveIns;
+  for (BasicBlock *B : L.blocks()) {
+    for (Instruction &I : *B) {
+      for (Value *op : I.operands()) {
+        if ( isa<Argument>(op) || (isa<Instruction>(op) && !L.contains(cast<Instruction>(op))) )
+          liveIns.insert(op);
+      }
+    }
+  }
+  for (PHINode &phi : L.getHeader()->phis())
+    liveIns.insert(&phi);
+  for (Value *V : liveIns)
+    freeRegs[regClass(V)]--;
+
+  // candidates by decreasing savings, the original order among equal ones
+  DenseMap<Instruction*, InstructionCost> savings;
+  SmallVector<Instruction*> order(loopInvInstr.begin(), loopInvInstr.end());
+  for (Instruction *I : order)
+    savings[I] = estimateSavings(I, L, TTI, tripCounts, LInv);
+  stable_sort(order, [&](Instruction *A, Instruction *B) { return savings[A] > savings[B]; });
+
+  for (Instruction *I : order) {
+    if ( hoisted.count(I) )
+      continue;
+    // the candidate with the candidate operands it needs, operands first
+    SetVector<Instruction*> group;
+    SmallVector<Instruction*> worklist = {I};
+    while ( !worklist.empty() ) {
+      Instruction *member = worklist.pop_back_val();
+      if ( !group.insert(member) )
+        continue;
+      for (Value *op : member->operands()) {
+        Instruction *opInst = dyn_cast<Instruction>(op);
+        if ( opInst && loopInvInstr.count(opInst) && !hoisted.count(opInst) )
+          worklist.push_back(opInst);
+      }
     }
+    InstructionCost groupCost = 0;
+    for (Instruction *member : group)
+      groupCost += TTI.getInstructionCost(member, TargetTransformInfo::TCK_SizeAndLatency);
+
+    // registers taken by the group, and freed by the operands no longer used in the loop
+    SmallPtrSet<Value*, 8> operands;
+    for (Instruction *member : group) {
+      for (Value *op : member->operands()) {
+        if ( (liveIns.count(op) || hoisted.count(dyn_cast<Instruction>(op))) && isLiveAcross(op) )
+          operands.insert(op);
+      }
+    }
+    for (Instruction *member : group)
+      hoisted.insert(member);
+    DenseMap<unsigned, int> delta;
+    for (Instruction *member : group) {
+      if ( isLiveAcross(member) )
+        delta[regClass(member)]++;
+    }
+    for (Value *op : operands) {
+      if ( !isLiveAcross(op) )
+        delta[regClass(op)]--;
+    }
+
+    bool fits = all_of(delta, [&](auto &classDelta) {
+      return classDelta.second <= 0 || classDelta.second <= freeRegs[classDelta.first];
+    });
+    if ( !fits && groupCost <= TargetTransformInfo::TCC_Basic ) {
+      D1("Keeping " << *I << " in the loop: no register left to keep it across the loop")
+      for (Instruction *member : group)
+        hoisted.erase(member);
+      continue;
+    }
+    for (auto &classDelta : delta)
+      freeRegs[classDelta.first] -= classDelta.second;
+    D2("\t" << *I << " is hoisted, savings " << savings[I])
   }
+
+  loopInvInstr.remove_if([&](Instruction *I) { return !hoisted.count(I); });
 }
 
 /*
@@ -287,9 +732,9 @@ void findCodeMotionCandidates(vector<Instruction*> &loopInvInstr, DominatorTree
 /*
 * function that checks if an operand prevents the instruction from being moved
 */
-bool isMovable(Value *op, vector<Instruction*> &loopInvInstr, Loop &L) {
+bool isMovable(Value *op, Loop &L) {
   // check if the operand is a constant, a function argument or an instruction that is not in the loop
-  if( isa<ConstantInt>(op) || isa<Argument>(op) || !L.contains( dyn_cast<Instruction>(op) ) ) {
+  if( !isa<Instruction>(op) || !L.contains( cast<Instruction>(op) ) ) {
     D2("Operand " << *op << " is a constant, an argument or a previously moved candidate")
     return true;
   }
@@ -299,67 +744,351 @@ bool isMovable(Value *op, vector<Instruction*> &loopInvInstr, Loop &L) {
 
 }
 
+/*
+* function that finds the loop to whose preheader 'I' is moved: from 'L' outwards, the outermost
+* loop of the nest in which 'I' is invariant and its operands are already available. Only the
+* instructions which can be speculated leave 'L' directly, since 'L' might not run on every
+* iteration of the enclosing loops; the others are hoisted one level at a time, when the
+* enclosing loop is visited
+*/
+Loop *getHoistTarget(Instruction *I, Loop &L, LoopInvarianceInfo &LInv) {
+  Loop *target = &L;
+  Loop *outermost = LInv.getOutermostInvariantLoop(I);
+  if ( !outermost || !isSafeToSpeculativelyExecute(I) )
+    return target;
+  while ( target != outermost ) {
+    Loop *parent = target->getParentLoop();
+    if ( !parent || !parent->getLoopPreheader() )
+      break;
+    bool operandsReady = all_of(I->operands(), [&](Value *op) {
+      return !isa<Instruction>(op) || !parent->contains(cast<Instruction>(op));
+    });
+    if ( !operandsReady )
+      break;
+    target = parent;
+  }
+  return target;
+}
+
 /*
 * function that moves the instruction to the preheader block
 */
-bool Move(Instruction *I, vector<Instruction*> &loopInvInstr, BasicBlock *phBB, Loop &L) {
-  auto itInst = find(loopInvInstr.begin(), loopInvInstr.end(), I);
-  
-  // chech if the instruction is in the list of loop invariant instructions
-  if ( itInst == loopInvInstr.end() ){
-    D3( " Trying to move an instruction that is not a candidate ")
+void Move(Instruction *I, BasicBlock *phBB) {
+  I->removeFromParent();                  // remove from the current block
+  I->setName( I->getName() + "_moved" );  // rename the instruction to avoid name conflicts
+  I->insertBefore(phBB->getTerminator()); // insert before the terminator of the preheader block
+  D1("Moved instruction " << *I << " to preheader block " << phBB->getName());
+}
+
+/*
+* function that performs the code motion: the candidates are moved in topological order, an
+* instruction becomes ready when all its operands are outside the loop. A candidate with an operand
+* which is neither outside the loop nor a candidate can not be moved, and neither can its users.
+* Each instruction goes to the preheader of the outermost loop where it is invariant (getHoistTarget):
+* its operands have been moved before it, so their final position is known.
+* Returns true if any instruction was moved
+*/
+bool codeMotion(InstrSet &loopInvInstr, Loop &L, LoopInvarianceInfo &LInv) {
+  D1("======\nCode Motion:\n======");
+
+  // check if the loop has a preheader
+  if (!L.getLoopPreheader()) { // even though we work on loops in normal form, we should keep this test if all previous ones fail
+    D1("No preheader for the loop -> cannot perform code motion!")
     return false;
   }
-  
-  D2(" Move call for instruction " << *I << " to preheader block " << *phBB);
-  Value *op1 = I->getOperand(0);
-  Value *op2 = I->getOperand(1);
+  BasicBlock* phBB = L.getLoopPreheader();          // get the preheader block
+  D2("Preheader found: " << phBB->getName());
 
-  // check if the operands are movable
-  if (!isMovable(op1, loopInvInstr, L) && !Move(dyn_cast<Instruction>(op1), loopInvInstr, phBB, L)) {
-    loopInvInstr.erase( itInst ); // remove from the list of loop invariant instructions
-    return false;
+  // number of operands of each candidate still to be moved, and the candidates using each candidate
+  DenseMap<Instruction*, unsigned> pendingOps;
+  DenseMap<Instruction*, SmallVector<Instruction*, 4>> candidateUsers;
+  SmallVector<Instruction*> ready;
+  for (Instruction *I : loopInvInstr) {
+    unsigned pending = 0;
+    for (Value *op : I->operands()) {
+      if (isMovable(op, L))
+        continue;
+      Instruction *opInst = cast<Instruction>(op);
+      if (!loopInvInstr.count(opInst)) {
+        D2("NOT MOVABLE: " << *I << " depends on " << *opInst << " which is not a candidate")
+        pending = ~0U;
+        break;
+      }
+      candidateUsers[opInst].push_back(I);
+      pending++;
+    }
+    pendingOps[I] = pending;
+    if (pending == 0)
+      ready.push_back(I);
   }
-  
-  if(!isMovable(op2, loopInvInstr, L) && !Move(dyn_cast<Instruction>(op2), loopInvInstr, phBB, L)) {
-    loopInvInstr.erase( itInst ); // remove from the list of loop invariant instructions
+
+  // the worklist is consumed in order, so independent candidates keep their original order
+  for (unsigned i = 0; i < ready.size(); i++) {
+    Instruction *I = ready[i];
+    Move(I, getHoistTarget(I, L, LInv)->getLoopPreheader());
+    for (Instruction *user : candidateUsers.lookup(I)) {
+      unsigned &pending = pendingOps[user];
+      if (pending != ~0U && --pending == 0)
+        ready.push_back(user);
+    }
+  }
+  D3("Moved " << ready.size() << " of " << loopInvInstr.size() << " instructions out of the loop with header " << L.getHeader()->getName());
+  loopInvInstr.clear();
+  return !ready.empty();
+}
+
+/*
+* SINKING FUNCTIONS
+*/
+
+/*
+* function that checks wether an instruction may be moved to the exit blocks: it must compute a
+* value without touching memory
+*/
+bool isSinkCandidate(Instruction &I) {
+  return isInvarianceCandidate(I) && !I.mayReadOrWriteMemory();
+}
+
+/*
+* function that checks if a block is an exit block of 'L' with the loop as its only predecessor
+*/
+bool isSinkTarget(BasicBlock *B, Loop &L) {
+  BasicBlock *pred = B->getSinglePredecessor();
+  return !L.contains(B) && pred && L.contains(pred);
+}
+
+/*
+* function that checks if all the uses of 'I' can be served by a copy in the exit blocks: in LCSSA
+* form they are the PHI nodes of the exit blocks, or the instructions already sunk there
+*/
+bool isUsedOnlyInExitBlocks(Instruction &I, Loop &L) {
+  if ( I.use_empty() )
+    return false;
+  return all_of(I.users(), [&](User *U) { return isSinkTarget(cast<Instruction>(U)->getParent(), L); });
+}
+
+/*
+* function that checks, before the uses are put in LCSSA form, if 'I' will be sunk: it must be used only
+* outside the loop, and each use must be reached through an exit block with the loop as its only
+* predecessor, which then gets the LCSSA PHI node replaced by the copy
+*/
+bool isSinkable(Instruction &I, Loop &L, DominatorTree &DT, SmallVector<BasicBlock*> &exitBBs) {
+  if ( !isSinkCandidate(I) || I.use_empty() )
+    return false;
+  return all_of(I.uses(), [&](Use &U) {
+    Instruction *userInst = cast<Instruction>(U.getUser());
+    if ( L.contains(userInst) )
+      return false;
+    // a PHI node uses the value at the end of the incoming block, unless it is the PHI node of an exit
+    BasicBlock *useBB = userInst->getParent();
+    if ( PHINode *usePHI = dyn_cast<PHINode>(userInst) ) {
+      if ( !L.contains(usePHI->getIncomingBlock(U)) )
+        useBB = usePHI->getIncomingBlock(U);
+    }
+    return any_of(exitBBs, [&](BasicBlock *exitBB) {
+      return isSinkTarget(exitBB, L) && DT.dominates(exitBB, useBB);
+    });
+  });
+}
+
+/*
+* function that sinks to the exit blocks the instructions of 'L' whose value is used only after the
+* loop, so they run once instead of on every iteration. The uses are first put in LCSSA form, then
+* an instruction is copied in each exit block using it and replaces the PHI node there.
+* An exit block reached from the loop is reached through the last iteration, where the instruction
+* was executed with the same operands, so no work which the loop did not do is introduced.
+* The blocks are visited in post-order and the instructions backwards, so the users are sunk before
+* their operands, which can then follow them in the exit blocks.
+* The LCSSA form is built only if an instruction is going to be sunk.
+* Returns true if the loop was changed
+*/
+bool sinkToExitBlocks(Loop &L, DominatorTree &DT, LoopInfo &LI) {
+  SmallVector<BasicBlock*> exitBBs;
+  L.getExitBlocks(exitBBs);
+  bool hasCandidates = any_of(L.blocks(), [&](BasicBlock *B) {
+    return any_of(*B, [&](Instruction &I) { return isSinkable(I, L, DT, exitBBs); });
+  });
+  if ( !hasCandidates )
     return false;
+  bool changed = formLCSSA(L, DT, &LI, nullptr);
+
+  LoopBlocksRPO RPO(&L);
+  RPO.perform(&LI);
+  SmallVector<BasicBlock*> blocks(RPO.begin(), RPO.end());
+  bool sunk = false;
+  for (BasicBlock *B : reverse(blocks)) {
+    for (Instruction &I : make_early_inc_range(reverse(*B))) {
+      if ( !isSinkCandidate(I) || !isUsedOnlyInExitBlocks(I, L) )
+        continue;
+      // one copy for each exit block
+      SmallDenseMap<BasicBlock*, Instruction*, 4> copies;
+      SmallVector<User*> users(I.users());
+      for (User *U : users) {
+        Instruction *userInst = cast<Instruction>(U);
+        BasicBlock *exitBlock = userInst->getParent();
+        Instruction *&copy = copies[exitBlock];
+        if ( !copy ) {
+          copy = I.clone();
+          copy->setName(I.getName() + "_sunk");
+          copy->insertBefore(&*exitBlock->getFirstInsertionPt());
+          D1("Sunk instruction " << *copy << " to exit block " << exitBlock->getName())
+        }
+        // the PHI node of a single predecessor block only forwards the value
+        if ( isa<PHINode>(userInst) ) {
+          userInst->replaceAllUsesWith(copy);
+          userInst->eraseFromParent();
+        } else {
+          userInst->replaceUsesOfWith(&I, copy);
+        }
+      }
+      I.eraseFromParent();
+      sunk = true;
+    }
   }
+  // the operands left in the loop are now used by the copies
+  if ( sunk )
+    formLCSSA(L, DT, &LI, nullptr);
+  return changed || sunk;
+}
 
-  // Move the instruction to the preheader block
-  I->removeFromParent();                  // remove from the current block
-  I->setName( I->getName() + "_moved" );  // rename the instruction to avoid name conflicts
-  I->insertBefore(phBB->getTerminator()); // insert before the terminator of the preheader block
-  // I->moveBefore(phBB->getTerminator());
-  D1("Moved instruction " << *I << " to preheader block " << *phBB);
-  loopInvInstr.erase( itInst );
+
+/*
+* LOOP UNSWITCHING FUNCTIONS
+*/
+
+/*
+* code growth allowed to the unswitching: each loop which is unswitched is duplicated
+*/
+static cl::opt<unsigned> unswitchThreshold("unswitch-growth-threshold", cl::init(100),
+    cl::desc("Number of instructions unswitch-pass may duplicate in each function"));
+
+/*
+* function that counts the instructions of a loop, subloops included
+*/
+unsigned getLoopSize(Loop &L) {
+  unsigned size = 0;
+  for (BasicBlock *B : L.blocks())
+    size += B->size();
+  return size;
+}
+
+/*
+* function that collects, operands first, the instructions of 'L' computing 'V' which have to be moved
+* to the preheader for 'V' to be available there: they must all be invariant and safe to execute on
+* every path. Returns false if 'V' can not be made available in the preheader
+*/
+bool collectConditionInstructions(Value *V, Loop &L, LoopInvarianceInfo &LInv,
+                                  SetVector<Instruction*> &toMove) {
+  Instruction *I = dyn_cast<Instruction>(V);
+  if ( !I || !L.contains(I) || toMove.count(I) )
+    return true;
+  if ( !isInvarianceCandidate(*I) || !LInv.isInvariant(I, L) || !isSafeToSpeculativelyExecute(I) )
+    return false;
+  for (Value *op : I->operands()) {
+    if ( !collectConditionInstructions(op, L, LInv, toMove) )
+      return false;
+  }
+  toMove.insert(I);
   return true;
+}
 
+/*
+* function that finds a conditional branch of 'L' whose condition is invariant in the loop and can be
+* computed in the preheader, nullptr if there is none
+*/
+BranchInst *findUnswitchCandidate(Loop &L, LoopInvarianceInfo &LInv, SetVector<Instruction*> &toMove) {
+  for (BasicBlock *B : L.blocks()) {
+    BranchInst *BI = dyn_cast<BranchInst>(B->getTerminator());
+    if ( !BI || !BI->isConditional() || BI->getSuccessor(0) == BI->getSuccessor(1)
+         || isa<Constant>(BI->getCondition()) || !LInv.isInvariant(BI->getCondition(), L) )
+      continue;
+    toMove.clear();
+    if ( collectConditionInstructions(BI->getCondition(), L, LInv, toMove) )
+      return BI;
+  }
+  return nullptr;
 }
 
 /*
-* function that performs the code motion
+* function that specializes a copy of the loop for one outcome of the unswitched branch: the branch
+* becomes unconditional and the other uses of the condition in the loop are replaced by the outcome
 */
-void codeMotion(vector<Instruction*> &loopInvInstr, Loop &L) {
-  D1("======\nCode Motion:\n======");
+void specializeLoop(BranchInst *BI, Loop &L, bool outcome) {
+  Value *cond = BI->getCondition();
+  BasicBlock *B = BI->getParent();
+  BasicBlock *taken = BI->getSuccessor(outcome ? 0 : 1);
+  BasicBlock *notTaken = BI->getSuccessor(outcome ? 1 : 0);
+  notTaken->removePredecessor(B);
+  BranchInst::Create(taken, BI);
+  BI->eraseFromParent();
+  Constant *value = outcome ? ConstantInt::getTrue(cond->getContext()) : ConstantInt::getFalse(cond->getContext());
+  cond->replaceUsesWithIf(value, [&](Use &U) {
+    Instruction *user = dyn_cast<Instruction>(U.getUser());
+    return user && L.contains(user);
+  });
+}
 
-  // check if the loop has a preheader
-  if (!L.getLoopPreheader()) { // even though we work on loops in normal form, we should keep this test if all previous ones fail
-    D1("No preheader for the loop -> cannot perform code motion!")
-    return;
-  } else {
-    BasicBlock* phBB = L.getLoopPreheader();          // get the preheader block
-    D2("Preheader found: " << *phBB); 
-    Instruction* lastMoved = phBB->getTerminator();   // get the last moved instruction in the preheader block
-    // while the vector of loop invariant instructions is not empty, we move the first instruction to the preheader block
-    while(!loopInvInstr.empty()){
-      D3("Get current first instruction in the vector: " << *loopInvInstr.front() );
-      Instruction *I = loopInvInstr.front();          // get the first instruction in the vector
-      Move(I, loopInvInstr, phBB, L);                 // move the instruction to the preheader block
-      D3("Moved instruction " << *I << " to preheader block after eventual recursive calls to Move()");
+/*
+* function that unswitches 'L' on the invariant branch 'BI': the branch is moved to the preheader and
+* selects between two copies of the loop, the original one specialized for the true outcome and a
+* clone specialized for the false one. The exits are shared by the two copies, the loop is put in
+* LCSSA form first so that the values used after the loop only need a new incoming value in the PHI
+* nodes of the exit blocks. The blocks left unreachable by the specialization are deleted
+*/
+void unswitchLoop(Loop &L, BranchInst *BI, SetVector<Instruction*> &toMove, DominatorTree &DT, LoopInfo &LI) {
+  Function &F = *L.getHeader()->getParent();
+  D1("Unswitching the loop with header " << L.getHeader()->getName() << " on " << *BI)
+
+  // the condition is computed in the preheader
+  for (Instruction *I : toMove)
+    Move(I, L.getLoopPreheader());
+  Value *cond = BI->getCondition();
+
+  if ( !L.hasDedicatedExits() )
+    formDedicatedExitBlocks(&L, &DT, &LI, nullptr, false);
+  formLCSSARecursively(L, DT, &LI, nullptr);
+  SmallVector<BasicBlock*> exitBBs;
+  L.getUniqueExitBlocks(exitBBs);
+
+  // an empty preheader for each copy of the loop, the old one will hold the unswitched branch
+  BasicBlock *PH = L.getLoopPreheader();
+  BasicBlock *truePH = SplitBlock(PH, PH->getTerminator(), &DT, &LI);
+  truePH->setName(L.getHeader()->getName() + ".us.true");
+  ValueToValueMapTy VMap;
+  SmallVector<BasicBlock*, 16> clonedBlocks;
+  Loop *falseLoop = cloneLoopWithPreheader(truePH, PH, &L, VMap, ".us", &LI, &DT, clonedBlocks);
+  remapInstructionsInBlocks(clonedBlocks, VMap);
+  BasicBlock *falsePH = cast<BasicBlock>(VMap[truePH]);
+  falsePH->setName(L.getHeader()->getName() + ".us.false");
+
+  // the exit blocks are reached from the clone too
+  for (BasicBlock *exitBlock : exitBBs) {
+    for (PHINode &phi : exitBlock->phis()) {
+      unsigned numIncoming = phi.getNumIncomingValues();
+      for (unsigned i = 0; i < numIncoming; i++) {
+        BasicBlock *incomingBB = phi.getIncomingBlock(i);
+        if ( !L.contains(incomingBB) )
+          continue;
+        Value *incoming = phi.getIncomingValue(i);
+        if ( Value *cloned = VMap.lookup(incoming) )
+          incoming = cloned;
+        phi.addIncoming(incoming, cast<BasicBlock>(VMap[incomingBB]));
+      }
     }
-    D3("Moved all instructions to preheader block " << *phBB);
   }
+
+  // the unswitched branch: a condition which might be poison is frozen, since the loop might not
+  // have executed the branch at all
+  BranchInst *falseBI = cast<BranchInst>(VMap[BI]);
+  bool mayBePoison = !isGuaranteedNotToBeUndefOrPoison(cond, nullptr, PH->getTerminator(), &DT);
+  PH->getTerminator()->eraseFromParent();
+  BranchInst *unswitched = BranchInst::Create(truePH, falsePH, cond, PH);
+  if ( mayBePoison )
+    unswitched->setCondition(new FreezeInst(cond, cond->getName() + ".fr", unswitched));
+
+  specializeLoop(BI, L, true);
+  specializeLoop(falseBI, *falseLoop, false);
+  removeUnreachableBlocks(F);
 }
 
 //-----------------------------------------------------------------------------
@@ -382,6 +1111,34 @@ struct As03Pass: PassInfoMixin<As03Pass> {
     // dominator tree 
     DominatorTree &DT = AM.getResult<DominatorTreeAnalysis>(F);
 
+    // costs of the instructions, for speculation
+    TargetTransformInfo &TTI = AM.getResult<TargetIRAnalysis>(F);
+
+    // scalar promotion, from the innermost loops outwards: an inner loop left with a load in its
+    // preheader and a store in its exits may make the location promotable in the outer loop too
+    AAResults &AA = AM.getResult<AAManager>(F);
+    bool changed = false;
+    SmallVector<Loop*> loops = LI.getLoopsInPreorder();
+    for (Loop *L : reverse(loops))
+      changed |= promoteLoopLocations(*L, AA, DT);
+    if (changed) {
+      // the loads and stores changed, the loops did not
+      PreservedAnalyses PA;
+      PA.preserveSet<CFGAnalyses>();
+      AM.invalidate(F, PA);
+    }
+
+    // loop invariance of the instructions, for the whole loop nest
+    LoopInvarianceInfo &LInv = AM.getResult<LoopInvariance>(F);
+
+    // estimated trip counts, for the savings of the cost model
+    ScalarEvolution &SE = AM.getResult<ScalarEvolutionAnalysis>(F);
+    DenseMap<Loop*, unsigned> tripCounts;
+    for (Loop *L : LI.getLoopsInPreorder()) {
+      unsigned tripCount = SE.getSmallConstantTripCount(L);
+      tripCounts[L] = tripCount ? tripCount : unknownTripCount;
+    }
+
     #ifdef DEBUG
     D3("======\nDominance tree in deep-first:\n======");
       for (auto *DTN : depth_first(DT.getRootNode())) {
@@ -389,62 +1146,78 @@ struct As03Pass: PassInfoMixin<As03Pass> {
       }
     #endif
 
-    // instruction vectors to be reused for each loop
-    vector<Instruction*> loopInvInstr;
+    // instruction set to be reused for each loop
+    InstrSet loopInvInstr;
 
-    // iterate on all TOP-LEVEL loops from function
-    for ( auto &L: LI ) {
-      SmallVector<Loop*> nestVect = L->getLoopsInPreorder();
-      for ( auto &NL: nestVect){
-        D1("############################\nCURRENTLY WORKING ON THE LEVEL " << NL->getLoopDepth() << " LOOP WITH HEADER BLOCK " << *NL->getHeader() << "\n############################");
+    // iterate on all loops, from the innermost ones outwards: the instructions left in a loop by
+    // its subloops are hoisted again by the enclosing loop, in the same run
+    SmallVector<Loop*> nestVect = LI.getLoopsInPreorder();
+    for ( auto &NL: reverse(nestVect) ){
+      D1("############################\nCURRENTLY WORKING ON THE LEVEL " << NL->getLoopDepth() << " LOOP WITH HEADER BLOCK " << *NL->getHeader() << "\n############################");
 
-        #ifdef DEBUG
-        D2("======\nLoop blocks:\n======");
-        for (Loop::block_iterator BI = NL->block_begin(); BI != NL->block_end(); ++BI) {
-          BasicBlock *B = *BI;
-          D2(*B);
-        }
-        D2("======")
-        #endif
-        // retrieve loop invariant instructions for current loop
-        getLoopInvInstructions(loopInvInstr, *NL);
+      #ifdef DEBUG
+      D2("======\nLoop blocks:\n======");
+      for (Loop::block_iterator BI = NL->block_begin(); BI != NL->block_end(); ++BI) {
+        BasicBlock *B = *BI;
+        D2(*B);
+      }
+      D2("======")
+      #endif
+      // retrieve loop invariant instructions for current loop
+      getLoopInvInstructions(loopInvInstr, *NL, LInv);
 
-        if (loopInvInstr.empty()) { // if there's no linv instructions
-          D1("\n******** No loop invariant instructions found; continue with next loop... ********\n")
-          continue;
-        }
+      if (loopInvInstr.empty()) { // if there's no linv instructions
+        D1("\n******** No loop invariant instructions found; continue with next loop... ********\n")
+        continue;
+      }
 
-        #ifdef DEBUG
-        D1("======\nLoop-invariant instructions:\n======");
-        for (auto I: loopInvInstr)
-          D1(*I);
-        #endif
+      #ifdef DEBUG
+      D1("======\nLoop-invariant instructions:\n======");
+      for (auto I: loopInvInstr)
+        D1(*I);
+      #endif
 
-        D1("\n======\nPerforming candidate checks...\n")
+      D1("\n======\nPerforming candidate checks...\n")
 
-        // code motion candidates
-        findCodeMotionCandidates(loopInvInstr, DT, *NL);
+      // code motion candidates
+      findCodeMotionCandidates(loopInvInstr, DT, TTI, *NL);
 
-        if (loopInvInstr.empty()) { // if there's no instructions suitable for the code motion
-          D1("\n******** No candidate instructions for code motion found; continue with next loop... ********\n")
-          continue;
-        }
+      if (loopInvInstr.empty()) { // if there's no instructions suitable for the code motion
+        D1("\n******** No candidate instructions for code motion found; continue with next loop... ********\n")
+        continue;
+      }
 
-        #ifdef DEBUG
-        D1("======\nCode motion candidates:\n======");
-        for (auto I: loopInvInstr)
-          D1(*I);
-        #endif
+      #ifdef DEBUG
+      D1("======\nCode motion candidates:\n======");
+      for (auto I: loopInvInstr)
+        D1(*I);
+      #endif
 
-        // code motion
-        codeMotion(loopInvInstr, *NL);
+      // cost model: the candidates worth a register across the loop
+      selectByRegisterPressure(loopInvInstr, *NL, TTI, tripCounts, LInv);
 
-        loopInvInstr.clear();
-      }
+      // code motion
+      changed |= codeMotion(loopInvInstr, *NL, LInv);
+
+      loopInvInstr.clear();
     }
 
-  	return PreservedAnalyses::all();
-}
+    // sinking, from the innermost loops outwards: an instruction sunk to the exit of an inner loop
+    // may be sunk again out of the enclosing loop
+    bool sunk = false;
+    for (Loop *L : reverse(LI.getLoopsInPreorder()))
+      sunk |= sinkToExitBlocks(*L, DT, LI);
+
+    if (!changed && !sunk)
+      return PreservedAnalyses::all();
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    // the instructions moved to a preheader left their loop: the invariance results still hold,
+    // unless the sinking changed the loops
+    if (!sunk)
+      PA.preserve<LoopInvariance>();
+    return PA;
+  }
 
 
   // Without isRequired returning true, this pass will be skipped for functions
@@ -452,6 +1225,66 @@ struct As03Pass: PassInfoMixin<As03Pass> {
   // all functions with optnone.
   static bool isRequired() { return true; }
 };
+
+// Printer of the loop invariance analysis
+struct LoopInvariancePrinter: PassInfoMixin<LoopInvariancePrinter> {
+  raw_ostream &OS;
+  explicit LoopInvariancePrinter(raw_ostream &OS) : OS(OS) {}
+
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM) {
+    LoopInfo &LI = AM.getResult<LoopAnalysis>(F);
+    LoopInvarianceInfo &LInv = AM.getResult<LoopInvariance>(F);
+    OS << "Loop invariant instructions of " << F.getName() << "\n";
+    for (Loop *L : LI.getLoopsInPreorder()) {
+      OS << "Loop at depth " << L->getLoopDepth() << " with header " << L->getHeader()->getName() << "\n";
+      for (BasicBlock *B : L->blocks()) {
+        for (Instruction &I : *B) {
+          if (isInvarianceCandidate(I) && LInv.isInvariant(&I, *L))
+            OS << I << "\n";
+        }
+      }
+    }
+    return PreservedAnalyses::all();
+  }
+  static bool isRequired() { return true; }
+};
+// Loop unswitching on the invariant conditions
+struct LoopUnswitch: PassInfoMixin<LoopUnswitch> {
+  PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM) {
+    unsigned budget = unswitchThreshold;
+    bool changed = false;
+    // one loop at a time: the loops and the invariance results change with each unswitching
+    while (true) {
+      LoopInfo &LI = AM.getResult<LoopAnalysis>(F);
+      DominatorTree &DT = AM.getResult<DominatorTreeAnalysis>(F);
+      LoopInvarianceInfo &LInv = AM.getResult<LoopInvariance>(F);
+
+      // the outermost loops first, so a branch leaves as many loops as possible
+      Loop *target = nullptr;
+      BranchInst *BI = nullptr;
+      SetVector<Instruction*> toMove;
+      unsigned size = 0;
+      for (Loop *L : LI.getLoopsInPreorder()) {
+        size = getLoopSize(*L);
+        if ( !L->getLoopPreheader() || !L->isSafeToClone() || size > budget )
+          continue;
+        if ( (BI = findUnswitchCandidate(*L, LInv, toMove)) ) {
+          target = L;
+          break;
+        }
+      }
+      if (!target)
+        break;
+
+      unswitchLoop(*target, BI, toMove, DT, LI);
+      budget -= size;
+      changed = true;
+      AM.invalidate(F, PreservedAnalyses::none());
+    }
+    return changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+  }
+  static bool isRequired() { return true; }
+};
 } // namespace
 
 //-----------------------------------------------------------------------------
@@ -460,6 +1293,11 @@ struct As03Pass: PassInfoMixin<As03Pass> {
 llvm::PassPluginLibraryInfo getTestPassPluginInfo() {
   return {LLVM_PLUGIN_API_VERSION, "As03Pass", LLVM_VERSION_STRING,
           [](PassBuilder &PB) {
+            // the loop invariance analysis, available through the analysis manager
+            PB.registerAnalysisRegistrationCallback(
+                [](FunctionAnalysisManager &FAM) {
+                  FAM.registerPass([] { return LoopInvariance(); });
+                });
             PB.registerPipelineParsingCallback(
                 [](StringRef Name, FunctionPassManager &FPM,
                    ArrayRef<PassBuilder::PipelineElement>) {
@@ -467,6 +1305,14 @@ llvm::PassPluginLibraryInfo getTestPassPluginInfo() {
                     FPM.addPass(As03Pass());
                     return true;
                   }
+                  if (Name == "unswitch-pass") {
+                    FPM.addPass(LoopUnswitch());
+                    return true;
+                  }
+                  if (Name == "print<loop-invariance>") {
+                    FPM.addPass(LoopInvariancePrinter(outs()));
+                    return true;
+                  }
                   return false;
                 });
           }};
@@ -0,0 +1,71 @@
+#!/bin/bash
+# Scaling benchmark for licm-pass: generates loops whose body has N instructions
+# (half of them loop invariant) and times the pass on each of them.
+# The time should grow linearly with N.
+
+opt_macos=false
+opt_linux=false
+SIZES="1000 2000 4000 8000 16000"
+
+while getopts ml opt; do
+    case $opt in
+        m) opt_macos=true ;;
+        l) opt_linux=true ;;
+        *) echo 'error while parsing arguments' >&2
+           exit 1
+    esac
+done
+
+shift "$(( OPTIND - 1 ))"
+
+# sizes can be given after the options
+[ $# -gt 0 ] && SIZES="$*"
+
+# For MacOS specific library extension; exported only with -m flag
+"$opt_macos" && LIB_EXT=".dylib" && echo "Running script on MacOS (dylib estension)"
+# same for Linux
+"$opt_linux" && LIB_EXT=".so" && echo "Running script on Linux (so extension)"
+
+if [ -z $LIB_EXT ]; then
+    echo "No platform specified (use -m for MacOS or -l for Linux)"
+    exit 1
+fi
+
+LIB_NAME="build/libAs03Pass$LIB_EXT"
+BENCH_DIR=$(mktemp -d)
+trap 'rm -rf $BENCH_DIR' EXIT
+
+# loop body: x_k = x_(k-1) + k is invariant, y_k = y_(k-1) + x_k (y_0 = i) is not
+generate() {
+    local N=$1
+    local K=$(( N / 2 ))
+    echo "define i32 @bench(i32 %a, i32 %b, i32 %n) {"
+    echo "entry:"
+    echo "  br label %loop"
+    echo "loop:"
+    echo "  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]"
+    echo "  %x0 = add nsw i32 %a, %b"
+    echo "  %y0 = add nsw i32 %i, 1"
+    for (( k = 1; k <= K; k++ )); do
+        echo "  %x$k = add nsw i32 %x$(( k - 1 )), $k"
+        echo "  %y$k = add nsw i32 %y$(( k - 1 )), %x$k"
+    done
+    echo "  %i.next = add nsw i32 %i, 1"
+    echo "  %cmp = icmp slt i32 %i.next, %n"
+    echo "  br i1 %cmp, label %loop, label %exit"
+    echo "exit:"
+    echo "  ret i32 %x$K"
+    echo "}"
+}
+
+TIMEFORMAT="%R"
+printf "%10s %10s\n" "N" "seconds"
+for N in $SIZES; do
+    FILE="$BENCH_DIR/Bench$N.ll"
+    generate $N > $FILE
+    if ! SECONDS_TAKEN=$( { time opt -load-pass-plugin $LIB_NAME -p licm-pass -disable-output $FILE > /dev/null 2>&1; } 2>&1 ); then
+        echo "licm-pass failed on $FILE" >&2
+        exit 1
+    fi
+    printf "%10s %10s\n" $N $SECONDS_TAKEN
+done
@@ -0,0 +1,11 @@
+#include <stdlib.h>
+
+int sumAbs(int *v, int n, short lo, int hi) {
+    int s = 0;
+    for (int i = 0; i < n; i++) {
+        int bound = lo > hi ? lo : hi;
+        int *base = v + abs(bound);
+        s += base[i] + (bound == 0);
+    }
+    return s;
+}
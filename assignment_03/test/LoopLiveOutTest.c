@@ -0,0 +1,11 @@
+int foo(int n, int a, int b) {
+    int x = 0;
+    for (int i = 0; i < n; i++) {
+        if (i > 5) {
+            x = a * b + 1;
+            if (x == i)
+                break;
+        }
+    }
+    return x;
+}
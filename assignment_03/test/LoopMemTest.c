@@ -0,0 +1,27 @@
+int total;
+int scale = 3;
+int values[64];
+int matrix[16][16];
+
+void accumulate(int n) {
+    for (int i = 0; i < n; i++) {
+        total += values[i] * scale;
+    }
+}
+
+int sumRows(int rows) {
+    int s = 0;
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < 16; c++) {
+            total += matrix[r][c];
+        }
+        s += total;
+    }
+    return s;
+}
+
+void scaleAll(int *v, int n) {
+    for (int i = 0; i < n; i++) {
+        v[i] = v[i] * scale;
+    }
+}
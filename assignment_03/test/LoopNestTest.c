@@ -0,0 +1,11 @@
+void stencil(int n, int a, int b, int c[64][64][64], int *out) {
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            for (int k = 0; k < n; k++) {
+                int w = a * b + 3;
+                int row = w * i;
+                out[k] += c[i][j][k] * row + w / b;
+            }
+        }
+    }
+}
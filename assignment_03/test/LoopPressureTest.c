@@ -0,0 +1,13 @@
+int foo(int n, int a, int b, int c, int d, int e, int f, int g, int h) {
+    int s = 0;
+    for (int i = 0; i < n; i++) {
+        s += (a + 1) * i;
+        s += (b + 2) ^ a;
+        s += (c + 3) - b;
+        s += (d + 4) | c;
+        s += (e + 5) & d;
+        s += (f + 6) * (g + 7) * e;
+        s += i / (h | 1) + f;
+    }
+    return s;
+}
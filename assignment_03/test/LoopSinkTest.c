@@ -0,0 +1,20 @@
+int lastSquare(int n, int a) {
+    int i = 0, sq = 0;
+    while (i < n) {
+        sq = i * i + a;
+        if (sq > 1000)
+            return sq - 1000;
+        i++;
+    }
+    return sq;
+}
+
+int lastProduct(int n, int m) {
+    int p = 0;
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < m; i++) {
+            p = i * j;
+        }
+    }
+    return p * 3;
+}
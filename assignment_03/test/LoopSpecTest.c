@@ -0,0 +1,11 @@
+int foo(int n, int a, int b) {
+    int s = 0, q = 0;
+    for (int i = 0; i < n; i++) {
+        if (i % 3 == 0) {
+            int x = a * b + 7;
+            s += x;
+            q = a / b;
+        }
+    }
+    return s + q;
+}
@@ -0,0 +1,21 @@
+int foo(int n, int c, int *v) {
+    int s = 0, t = 0;
+    for (int i = 0; i < n; i++) {
+        if (c > 0)
+            t = v[i] * 2;
+        else
+            t = v[i] + 3;
+        s += t;
+    }
+    return s + t;
+}
+
+int bar(int n, int c, int *v) {
+    int s = 0;
+    for (int i = 0; i < n; i++) {
+        if (c == 7)
+            break;
+        s += v[i];
+    }
+    return s;
+}